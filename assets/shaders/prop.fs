@@ -2,16 +2,24 @@
 
 precision mediump float;
 
+// must match LIGHTS_PER_CHUNK in game.c
+#define MAX_LIGHTS 16
+
 // Input vertex attributes (from vertex shader)
 varying vec2 fragTexCoord;
 varying vec4 fragColor;
+varying vec2 fragPosition;
 
 // Input uniform values
 uniform sampler2D texture0;
 uniform vec4 colDiffuse;
 
 // NOTE: Add here your custom variables
-
+uniform vec3 ambient;
+uniform int lightCount;
+// x/z relative to lightOrigin, radius
+uniform vec3 lightPositions[MAX_LIGHTS];
+uniform vec3 lightColors[MAX_LIGHTS];
 
 void main()
 {
@@ -20,6 +28,14 @@ void main()
     if  (texelColor.a < 1.0) {discard;}
 
     // NOTE: Implement here your fragment shader code
-
-    gl_FragColor = texelColor*colDiffuse*fragColor;
-}
\ No newline at end of file
+    vec3 light = ambient;
+    for (int i = 0; i < MAX_LIGHTS; i++)
+    {
+        if (i >= lightCount) break;
+        vec2 d = (fragPosition - lightPositions[i].xy) / lightPositions[i].z;
+        // gaussian matching the old light0.png falloff
+        light += lightColors[i] * exp(-4.9 * dot(d, d));
+    }
+
+    gl_FragColor = texelColor*colDiffuse*fragColor*vec4(min(light, 1.0), 1.0);
+}
@@ -12,19 +12,34 @@ uniform mat4 mvp;
 // Output vertex attributes (to fragment shader)
 varying vec2 fragTexCoord;
 varying vec4 fragColor;
+varying vec2 fragPosition;
 
 // NOTE: Add here your custom variables
-uniform sampler2D texLightmap;
+// world x/z of the chunk the current lights are relative to
+uniform vec2 lightOrigin;
+// animation ticks of the sim, modulo 65536
+uniform float animTick;
+// width of one animation frame in uv
+uniform float frameWidth;
 
 void main()
 {
     // Send vertex attributes to fragment shader
     fragTexCoord = vertexTexCoord;
-    //fragColor = vertexColor;
+    fragColor = vertexColor;
 
-    vec2 coords = vec2((128.0 + vertexPosition.x) / 256.0, (128.0 + vertexPosition.z) / 256.0); 
-    fragColor = vec4( texture2D(texLightmap, vec2( coords.x, 1.0 - coords.y )).rgb, 1.0 );
+    // anything but white is an animated sprite: frames, ticks per frame and the start tick in two bytes
+    if (vertexColor.r < 1.0)
+    {
+        vec4 anim = floor(vertexColor*255.0 + 0.5);
+        float elapsed = mod(animTick - (anim.b + anim.a*256.0), 65536.0);
+        // frames count down from the last one, the texture coordinates are on frame 0
+        float frame = anim.r - 1.0 - mod(floor(elapsed/anim.g), anim.r);
+        fragTexCoord.x += frame*frameWidth;
+        fragColor = vec4(1.0);
+    }
+    fragPosition = vertexPosition.xz - lightOrigin;
     
     // Calculate final vertex position
     gl_Position = mvp*vec4(vertexPosition, 1.0);
-}
\ No newline at end of file
+}
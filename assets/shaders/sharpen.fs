@@ -0,0 +1,41 @@
+#version 330
+
+// Input vertex attributes (from vertex shader)
+in vec2 fragTexCoord;
+in vec4 fragColor;
+
+// Input uniform values
+uniform sampler2D texture0;
+uniform vec4 colDiffuse;
+
+// NOTE: Add here your custom variables
+// one canvas texel, and the last texel centre of the rendered area, both in uv
+uniform vec2 texelSize;
+uniform vec2 uvMax;
+// 0 is a plain bilinear upscale
+uniform float sharpness;
+
+// Output fragment color
+out vec4 finalColor;
+
+vec3 Fetch(vec2 uv)
+{
+    // the canvas beyond the rendered area holds older, larger frames
+    return texture(texture0, min(uv, uvMax)).rgb;
+}
+
+void main()
+{
+    vec3 c = Fetch(fragTexCoord);
+    vec3 n = Fetch(fragTexCoord + vec2(0.0, texelSize.y));
+    vec3 s = Fetch(fragTexCoord - vec2(0.0, texelSize.y));
+    vec3 e = Fetch(fragTexCoord + vec2(texelSize.x, 0.0));
+    vec3 w = Fetch(fragTexCoord - vec2(texelSize.x, 0.0));
+
+    // unsharp mask, kept inside the neighbourhood's range so edges don't ring
+    vec3 sharpened = c + sharpness*(4.0*c - n - s - e - w)*0.25;
+    vec3 lo = min(c, min(min(n, s), min(e, w)));
+    vec3 hi = max(c, max(max(n, s), max(e, w)));
+
+    finalColor = vec4(clamp(sharpened, lo, hi), 1.0)*colDiffuse*fragColor;
+}
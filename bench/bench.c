@@ -0,0 +1,428 @@
+//Microbenchmarks for the hot simulation paths in src2/game.c
+//
+//  bench [--out file.json] [--compare baseline.json] [--threshold 0.15]
+//
+//game.c is included directly so the file-static pools and helpers are reachable,
+//build with large MAX_* capacities (see the bench target in the makefile).
+//
+//bench/baseline.json is committed along with the cpu and compiler it was taken with, timings only compare on
+//a matching machine, so record your own with make bench_baseline before relying on make bench_compare.
+#include <stdlib.h>
+#include <stdint.h>
+
+static uint64_t benchAllocs = 0;
+
+//the makefile links with -Wl,--wrap for these, so every call from game.c and the static raylib (MemAlloc,
+//RL_MALLOC, RL_CALLOC, RL_REALLOC) lands here, allocations libc makes for itself (fopen, strdup) are not seen
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    benchAllocs++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    benchAllocs++;
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    benchAllocs++;
+    return __real_realloc(ptr, size);
+}
+
+#include "../src2/game.c"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define BENCH_MIN_TIME 0.1
+#define BENCH_MAX_RESULTS 64
+#define BENCH_PROJECTILES 64
+#define BENCH_MOVERS 256
+
+typedef struct {
+    const char* name;
+    void (*Setup)(int n);
+    void (*Run)(int n);
+    //zero terminated, BenchCounts when NULL
+    const int* counts;
+} Benchmark;
+
+typedef struct {
+    char name[64];
+    int n;
+    double nsPerOp;
+    double allocsPerOp;
+    double cacheMissesPerOp;    //negative when perf_event is unavailable
+} BenchResult;
+
+static int cacheMissFd = -1;
+static int spawnSlot = 0;
+static int itemPayload[2] = {WT_Pistol, 10};
+static Vector2 movers[BENCH_MOVERS][2];
+static int moverTurn = 0;
+
+static double BenchTime(void) {
+    return NetTime();
+}
+
+static void OpenCacheMissCounter(void) {
+#if defined(__linux__)
+    struct perf_event_attr attr = {0};
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    cacheMissFd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+}
+
+static void StartCacheMisses(void) {
+#if defined(__linux__)
+    if(cacheMissFd < 0) { return; }
+    ioctl(cacheMissFd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(cacheMissFd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+}
+
+static long long StopCacheMisses(void) {
+#if defined(__linux__)
+    if(cacheMissFd < 0) { return -1; }
+    ioctl(cacheMissFd, PERF_EVENT_IOC_DISABLE, 0);
+    long long count = 0;
+    if(read(cacheMissFd, &count, sizeof(count)) != sizeof(count)) { return -1; }
+    return count;
+#else
+    return -1;
+#endif
+}
+
+#pragma region World
+static void ResetWorld(void) {
+    FreeGame(game);
+    game = NewGame(42);
+    game->localPlayer = 0;
+    game->deltaTime = 1.0 / 60.0;
+    RebuildEnemyLists(game);
+    InitPlayer(game, &game->Players[0], 0);
+}
+
+//one enemy is spawned and copied into the first n slots, then the free list and groups are rebuilt once,
+//which leaves the same pools n SpawnEnemy calls would without rolling each one
+static void FillEnemies(int n) {
+    SpawnEnemy(game, ET_Amogus, 0, 0);
+    Enemy e = game->Enemies[0];
+    e.spawnTimer = 0;
+    for(int i = 0; i < n && i < MAX_ENEMIES; i++) {
+        game->Enemies[i] = e;
+        SetEnemyPosition(&game->Enemies[i], (Vector2){GetGameRandom(game, -90, 90), GetGameRandom(game, -90, 90)});
+    }
+    RebuildEnemyLists(game);
+}
+
+static void FillItems(int n) {
+    for(int i = 0; i < n && i < MAX_ITEMS; i++) {
+        game->Items[i] = (Item){
+            .active = true,
+            .position = {GetGameRandom(game, -90, 90), 1, GetGameRandom(game, -90, 90)},
+            .spriteRect = GetAtlasRect(AMO_OFFSET),
+            .data = itemPayload,
+            .OnPickUp = &OnPickUpAmmo,
+        };
+    }
+}
+
+static void KeepPlayerAlive(void) {
+    game->Players[0].health = game->Players[0].healthMax = 1 << 30;
+    game->Players[0].alive = true;
+    game->outcome = MO_None;
+}
+#pragma endregion
+
+#pragma region Benchmarks
+//one slot short of full so the spawn always lands
+static void SetupSpawnEnemy(int n) {
+    ResetWorld();
+    FillEnemies(n < MAX_ENEMIES ? n : MAX_ENEMIES - 1);
+}
+
+//pops a slot off the free list and gives it back the way a kill does, so the pools stay at n
+static void RunSpawnEnemy(int n) {
+    SpawnEnemy(game, ET_Amogus, 0, 0);
+    int id = game->FreeEnemySlots[game->freeEnemyCount];
+    Enemy* e = &game->Enemies[id];
+    e->alive = false;
+    RemoveEnemyFromGroup(game, e);
+    game->FreeEnemySlots[game->freeEnemyCount++] = id;
+}
+
+static void SetupUpdateEnemies(int n) {
+    ResetWorld();
+    FillEnemies(n);
+}
+
+static void RunUpdateEnemies(int n) {
+    KeepPlayerAlive();
+    UpdateEnemies(game);
+}
+
+static void SetupUpdateProjectiles(int n) {
+    ResetWorld();
+    FillEnemies(n);
+}
+
+//projectiles are parked above the arena so they test against every enemy without ever exploding
+static void RunUpdateProjectiles(int n) {
+    for(int i = 0; i < BENCH_PROJECTILES; i++) {
+        game->Projectiles[i] = (Projectile){
+            .active = true,
+            .position = {GetGameRandom(game, -90, 90), 50, GetGameRandom(game, -90, 90)},
+            .velocity = {0, 0, 1},
+            .speed = 13,
+        };
+    }
+    UpdateProjectiles(game);
+}
+
+static void SetupDamageRadius(int n) {
+    ResetWorld();
+    FillEnemies(n);
+}
+
+static void RunDamageRadius(int n) {
+    DamageEnemiesRadius(game, (Vector3){0, 1, 0}, 9.5f, 0);
+}
+
+static void SetupShotgun(int n) {
+    ResetWorld();
+    FillEnemies(n);
+    game->Players[0].selectedWeapon = WT_Shotgun;
+    game->Players[0].weapons[WT_Shotgun].damage = 0;
+}
+
+static void RunShotgun(int n) {
+    game->Players[0].rotation.y = GetGameRandom(game, 0, 359);
+    OnShootShotgun(game, &game->Players[0]);
+}
+
+static void SetupUpdateItems(int n) {
+    ResetWorld();
+    FillItems(n);
+    game->Players[0].position = (Vector2){1000, 1000};
+}
+
+static void RunUpdateItems(int n) {
+    UpdateItems(game);
+}
+
+static void SetupSpawnItem(int n) {
+    ResetWorld();
+    FillItems(n);
+}
+
+static void RunSpawnItem(int n) {
+    ArenaReset(&game->waveArenas[game->waveArena]);
+    spawnSlot = GetFreeItemId(game);
+    SpawnRandomItem(game, GetGameRandom(game, 0, 2), 0, 0);
+    if(spawnSlot >= 0 && game->Items[spawnSlot].active) { DeleteItem(&game->Items[spawnSlot]); }
+}
+
+static void SetupMoveCircle(int n) {
+    ResetWorld();
+    for(int i = 0; i < n && i < MAX_PROPS; i++) {
+        game->Props[i] = (Prop){
+            .active = true,
+            .position = {GetGameRandom(game, -SPAWN_EXTENT, SPAWN_EXTENT), 1, GetGameRandom(game, -SPAWN_EXTENT, SPAWN_EXTENT)},
+        };
+    }
+    BuildCollision(game);
+    for(int i = 0; i < BENCH_MOVERS; i++) {
+        movers[i][0] = (Vector2){GetGameRandom(game, -WALK_EXTENT, WALK_EXTENT), GetGameRandom(game, -WALK_EXTENT, WALK_EXTENT)};
+        movers[i][1] = Vector2Scale(Vector2Normalize((Vector2){GetGameRandom(game, -10, 10), GetGameRandom(game, -10, 10) + 0.5f}), 5.0f / 60.0f);
+    }
+}
+
+//one enemy sized step per op, the movers take turns so consecutive queries land all over the map
+static void RunMoveCircle(int n) {
+    Vector2* m = movers[moverTurn++ % BENCH_MOVERS];
+    m[0] = MoveCircle(game, m[0], m[1], ENEMY_RADIUS);
+    if(fabsf(m[0].x) > WALK_EXTENT) { m[1].x = -m[1].x; }
+    if(fabsf(m[0].y) > WALK_EXTENT) { m[1].y = -m[1].y; }
+}
+
+static const int PropCounts[] = {100, 1000, 10000, 0};
+
+static const Benchmark Benchmarks[] = {
+    {"SpawnEnemy", &SetupSpawnEnemy, &RunSpawnEnemy},
+    {"UpdateEnemies", &SetupUpdateEnemies, &RunUpdateEnemies},
+    {"UpdateProjectiles", &SetupUpdateProjectiles, &RunUpdateProjectiles},
+    {"DamageEnemiesRadius", &SetupDamageRadius, &RunDamageRadius},
+    {"OnShootShotgun", &SetupShotgun, &RunShotgun},
+    {"UpdateItems", &SetupUpdateItems, &RunUpdateItems},
+    {"SpawnRandomItem", &SetupSpawnItem, &RunSpawnItem},
+    {"MoveCircle", &SetupMoveCircle, &RunMoveCircle, PropCounts},
+};
+static const int BenchCounts[] = {10, 100, 1000, 10000, 100000, 0};
+#pragma endregion
+
+static BenchResult RunBenchmark(const Benchmark* b, int n) {
+    b->Setup(n);
+    b->Run(n);
+    uint64_t ops = 0;
+    uint64_t batch = 1;
+    uint64_t allocs = benchAllocs;
+    double elapsed = 0;
+    StartCacheMisses();
+    double start = BenchTime();
+    while(elapsed < BENCH_MIN_TIME) {
+        for(uint64_t i = 0; i < batch; i++) {
+            b->Run(n);
+        }
+        ops += batch;
+        batch *= 2;
+        elapsed = BenchTime() - start;
+    }
+    long long misses = StopCacheMisses();
+    BenchResult r = {
+        .n = n,
+        .nsPerOp = elapsed * 1e9 / ops,
+        .allocsPerOp = (double)(benchAllocs - allocs) / ops,
+        .cacheMissesPerOp = misses < 0 ? -1 : (double)misses / ops,
+    };
+    snprintf(r.name, sizeof(r.name), "%s", b->name);
+    return r;
+}
+
+//the cpu's model name, or "unknown" where /proc/cpuinfo isn't there
+static void GetCpuName(char* out, int size) {
+    snprintf(out, size, "unknown");
+    FILE* f = fopen("/proc/cpuinfo", "r");
+    if(!f) { return; }
+    char line[256];
+    while(fgets(line, sizeof(line), f)) {
+        const char* colon = strchr(line, ':');
+        if(strncmp(line, "model name", 10) || !colon) { continue; }
+        snprintf(out, size, "%s", colon + 2);
+        out[strcspn(out, "\n\"")] = 0;
+        break;
+    }
+    fclose(f);
+}
+
+static void WriteResults(FILE* f, const BenchResult* results, int count) {
+    char cpu[128];
+    GetCpuName(cpu, sizeof(cpu));
+    fprintf(f, "{\n  \"capacity\": {\"enemies\": %d, \"items\": %d, \"projectiles\": %d, \"props\": %d},\n",
+        MAX_ENEMIES, MAX_ITEMS, MAX_PROJECTILES, MAX_PROPS);
+    fprintf(f, "  \"machine\": {\"cpu\": \"%s\", \"compiler\": \"%s\"},\n  \"results\": [\n", cpu, __VERSION__);
+    for(int i = 0; i < count; i++) {
+        const BenchResult* r = &results[i];
+        fprintf(f, "    {\"name\": \"%s\", \"n\": %d, \"ns_per_op\": %.1f, \"allocs_per_op\": %.3f, \"cache_misses_per_op\": ",
+            r->name, r->n, r->nsPerOp, r->allocsPerOp);
+        if(r->cacheMissesPerOp < 0) { fprintf(f, "null}"); }
+        else { fprintf(f, "%.1f}", r->cacheMissesPerOp); }
+        fprintf(f, "%s\n", i + 1 < count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+//reads back the one-result-per-line layout WriteResults produces, and the cpu it was taken on
+static int ReadBaseline(const char* path, BenchResult* results, int max, char* cpu, int cpuSize) {
+    FILE* f = fopen(path, "r");
+    if(!f) { return -1; }
+    char line[512];
+    int count = 0;
+    while(count < max && fgets(line, sizeof(line), f)) {
+        BenchResult r = {0};
+        const char* machine = strstr(line, "\"cpu\": \"");
+        if(machine) {
+            snprintf(cpu, cpuSize, "%s", machine + 8);
+            cpu[strcspn(cpu, "\"")] = 0;
+            continue;
+        }
+        const char* start = strchr(line, '{');
+        if(start && sscanf(start, "{\"name\": \"%63[^\"]\", \"n\": %d, \"ns_per_op\": %lf", r.name, &r.n, &r.nsPerOp) == 3) {
+            results[count++] = r;
+        }
+    }
+    fclose(f);
+    return count;
+}
+
+static int CompareResults(const BenchResult* current, int count, const BenchResult* baseline, int baseCount, double threshold) {
+    int regressions = 0;
+    for(int i = 0; i < count; i++) {
+        const BenchResult* c = &current[i];
+        for(int j = 0; j < baseCount; j++) {
+            const BenchResult* b = &baseline[j];
+            if(strcmp(b->name, c->name) || b->n != c->n || b->nsPerOp <= 0) { continue; }
+            double change = c->nsPerOp / b->nsPerOp - 1.0;
+            bool regressed = change > threshold;
+            fprintf(stderr, "%-20s n=%-7d %12.1f -> %12.1f ns/op %+6.1f%%%s\n",
+                c->name, c->n, b->nsPerOp, c->nsPerOp, change * 100.0, regressed ? "  REGRESSION" : "");
+            regressions += regressed;
+        }
+    }
+    return regressions;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* outPath = NULL;
+    const char* baselinePath = NULL;
+    double threshold = 0.15;
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--out") && i + 1 < argc) { outPath = argv[++i]; }
+        else if(!strcmp(argv[i], "--compare") && i + 1 < argc) { baselinePath = argv[++i]; }
+        else if(!strcmp(argv[i], "--threshold") && i + 1 < argc) { threshold = atof(argv[++i]); }
+    }
+    SetTraceLogLevel(LOG_WARNING);
+    OpenCacheMissCounter();
+
+    BenchResult results[BENCH_MAX_RESULTS];
+    int count = 0;
+    for(size_t b = 0; b < sizeof(Benchmarks) / sizeof(Benchmarks[0]); b++) {
+        const int* counts = Benchmarks[b].counts ? Benchmarks[b].counts : BenchCounts;
+        for(int c = 0; counts[c]; c++) {
+            results[count] = RunBenchmark(&Benchmarks[b], counts[c]);
+            fprintf(stderr, "%-20s n=%-7d %12.1f ns/op\n", results[count].name, results[count].n, results[count].nsPerOp);
+            count++;
+        }
+    }
+
+    FILE* out = outPath ? fopen(outPath, "w") : stdout;
+    if(!out) {
+        fprintf(stderr, "Could not write %s\n", outPath);
+        return 1;
+    }
+    WriteResults(out, results, count);
+    if(out != stdout) { fclose(out); }
+
+    if(baselinePath) {
+        BenchResult baseline[BENCH_MAX_RESULTS];
+        char baseCpu[128] = "unknown";
+        char cpu[128];
+        int baseCount = ReadBaseline(baselinePath, baseline, BENCH_MAX_RESULTS, baseCpu, sizeof(baseCpu));
+        if(baseCount < 0) {
+            fprintf(stderr, "Could not read baseline %s, record one with make bench_baseline\n", baselinePath);
+            return 1;
+        }
+        GetCpuName(cpu, sizeof(cpu));
+        if(strcmp(cpu, baseCpu)) {
+            fprintf(stderr, "Baseline was taken on %s, this is %s, timings may not compare\n", baseCpu, cpu);
+        }
+        int regressions = CompareResults(results, count, baseline, baseCount, threshold);
+        fprintf(stderr, "%d regression(s) beyond %.0f%%\n", regressions, threshold * 100.0);
+        return regressions ? 1 : 0;
+    }
+    return 0;
+}
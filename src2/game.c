@@ -1,35 +1,237 @@
 #include <raylib.h>
 #include <raymath.h>
 #include <rlgl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "game.h"
+#include "net.h"
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
 
 
 #define uint unsigned int
+#ifndef MAX_ENEMIES
 #define MAX_ENEMIES 100
+#endif
+#ifndef MAX_PROJECTILES
 #define MAX_PROJECTILES 250
+#endif
+#ifndef MAX_PROPS
 #define MAX_PROPS 100
+#endif
+#ifndef MAX_ITEMS
 #define MAX_ITEMS 200
+#endif
+#define MAX_PLAYERS 8
+#define ATLAS_COLUMNS 4
 #define WEP_OFFSET 8
 #define AMO_OFFSET 3
 #define MKT_OFFSET 0
 #define BAG_OFFSET 2
 #define MHP_OFFSET 1
+#ifndef MAP_SIZE
 #define MAP_SIZE 256
+#endif
+//the ground is split into chunks, each visible one gets its own short list of lights
+#define CHUNK_SIZE 64
+#define CHUNK_TEXELS (CHUNK_SIZE * 4)
+#define WORLD_CHUNKS (MAP_SIZE / CHUNK_SIZE)
+#if MAP_SIZE % CHUNK_SIZE
+#error MAP_SIZE must be a multiple of CHUNK_SIZE
+#endif
+#ifndef VIEW_RADIUS
+#define VIEW_RADIUS 80
+#endif
+//chunks this close to the viewer draw their ground, the ones within VIEW_RADIUS are lit as well
+#ifndef RESIDENT_RADIUS
+#define RESIDENT_RADIUS (VIEW_RADIUS + CHUNK_SIZE / 2)
+#endif
+//window around the viewer's chunk that holds every chunk within RESIDENT_RADIUS
+#define VIEW_CHUNKS (2 * ((RESIDENT_RADIUS + CHUNK_SIZE - 1) / CHUNK_SIZE) + 1)
+//their ground tiles, the ground texture with the props' shadows baked in, are streamed into a fixed pool
+//of CHUNK_VRAM_BUDGET bytes of RGBA texels and mipmaps, the least recently drawn one is baked over first
+#ifndef CHUNK_VRAM_BUDGET
+#define CHUNK_VRAM_BUDGET (12 * 1024 * 1024)
+#endif
+#define CHUNK_TILE_BYTES (CHUNK_TEXELS * CHUNK_TEXELS * 4 * 4 / 3)
+#define MAX_RESIDENT_CHUNKS (CHUNK_VRAM_BUDGET / CHUNK_TILE_BYTES)
+#if MAX_RESIDENT_CHUNKS < 1
+#error CHUNK_VRAM_BUDGET must hold at least one ground tile
+#endif
+//a bake is a few ms, chunks over this many per frame draw the plain ground texture until their turn
+#define TILE_BAKES_PER_FRAME 1
+#define PROP_SHADOW_RADIUS 0.9f
+#define PROP_SHADOW_DEPTH 0.55f
+#ifndef MAX_VISIBLE_CHUNKS
+#define MAX_VISIBLE_CHUNKS 16
+#endif
+#if MAX_VISIBLE_CHUNKS > 255
+#error MAX_VISIBLE_CHUNKS must fit the byte sized view window
+#endif
+//must match MAX_LIGHTS in prop.fs
+#define LIGHTS_PER_CHUNK 16
+#define LIGHT_AMBIENT 0x01021aFF
+#define WALK_EXTENT (MAP_SIZE / 2 - 28)
+#define SPAWN_EXTENT (MAP_SIZE / 2 - 38)
+
+#define NET_PORT 27015
+#define NET_TICK_RATE 30
+#define NET_HISTORY 32
+#define NET_POS_SCALE 32.0f
+#define NET_INTERP_TICKS 2
+#define NET_TIMEOUT 5.0
+#define NET_RELEVANT_RADIUS 32.0f
+#ifndef NET_PACKET_BUDGET
+#define NET_PACKET_BUDGET 1200
+#endif
+#define NET_ENTITY_MAX_BYTES 24
+//props per welcome part, sized for the longest varints so a part always fits NET_PACKET_BUDGET
+#define NET_WELCOME_PROPS ((NET_PACKET_BUDGET - 16) / 11)
+#define NET_WELCOME_PARTS ((MAX_PROPS + NET_WELCOME_PROPS - 1) / NET_WELCOME_PROPS)
+#define NET_ENTITY_COUNT (MAX_ENEMIES + MAX_ITEMS + MAX_PROJECTILES)
+
+//text, crosshair and two quads per radar pip all go into one batch
+//props, items and enemies, everything drawn as a lit billboard
+#define BILLBOARD_COUNT (MAX_PROPS + MAX_ITEMS + MAX_ENEMIES)
+#define LIGHT_SOURCE_COUNT (MAX_PLAYERS * 3 + MAX_PROJECTILES + MAX_ITEMS)
+#define MAX_SOUND_EVENTS 64
+#define MAX_EFFECT_EVENTS 64
+//particles are only for show and live on the main thread, the simulation just queues where effects go off
+#ifndef PARTICLE_BUDGET
+#define PARTICLE_BUDGET 4096
+#endif
+#define PARTICLE_BUDGET_MIN 256
+//share of the frame budget particles may take before their live budget shrinks
+#define PARTICLE_COST_SHARE 0.08
+#define PARTICLE_GRAVITY 9.8f
+#define LATENCY_SAMPLES 64
+//the 3D pass never drops below half the screen resolution on each axis
+#define RENDER_SCALE_MIN 0.5f
+#define RENDER_SCALE_STEP 0.05f
+//frames to leave the scale alone after a change, longer after a drop so it doesn't bounce off the budget
+#define RENDER_SCALE_HOLD_DOWN 120
+#define RENDER_SCALE_HOLD_UP 30
+#define RENDER_SCALE_SMOOTHING 0.1
+//frame budget for the scale controller when nothing else sets the pace
+#define RENDER_SCALE_FALLBACK_FPS 60
+//gpu timer queries in flight, results are read back this many frames late at most so reading never stalls
+#define GPU_TIMER_QUERIES 4
+
+#define HUD_BATCH_QUADS (MAX_ENEMIES * 2 + 1024)
+
+//the built-in bot backs off from anything inside DANGER, closes in on targets beyond ENGAGE
+#define BOT_DANGER_RADIUS 7.0f
+#define BOT_ENGAGE_RADIUS 14.0f
+#define BOT_PICKUP_RADIUS 30.0f
+#define BOT_FIRE_RANGE 30.0f
+//degrees per second, so its aim visibly sweeps instead of snapping
+#define BOT_TURN_RATE 540.0f
+//wall distance at which it starts steering back toward the middle
+#define BOT_EDGE_MARGIN 12.0f
+//frame time histogram for the per-wave report, 0.5 ms buckets with the last one catching everything slower
+#define WAVE_STATS_BUCKETS 200
+#define WAVE_STATS_BUCKET_MS 0.5
+
+//metrics endpoint, scrapes are answered between frames so only a handful can be in flight
+#define METRICS_MAX_CONNECTIONS 4
+#define METRICS_REQUEST_TIMEOUT 2.0
+#define METRICS_TEXT_SIZE 8192
+#define METRICS_TIME_BUCKETS 8
+
+//headless sessions step at a fixed rate so a seed always plays out the same
+#define BATCH_TICK_RATE 60
+#define BATCH_MAX_THREADS 64
+
+//wave spawns are spread over SPAWN_WINDOW seconds, never more than SPAWN_MAX_PER_TICK at once
+#ifndef SPAWN_WINDOW
+#define SPAWN_WINDOW 1.5f
+#endif
+#ifndef SPAWN_MAX_PER_TICK
+#define SPAWN_MAX_PER_TICK 16
+#endif
+//requests for the next wave generated per tick while the current one is still being played
+#define SPAWN_PREPARE_PER_TICK 8
+//seconds an enemy spends rising out of the ground, 0 pops them in
+#ifndef SPAWN_IN_TIME
+#define SPAWN_IN_TIME 0.6f
+#endif
+#define SPAWN_QUEUE_SIZE (MAX_ENEMIES + 8)
+
+//wandering enemies farther than detectRange + ENEMY_LOD_MARGIN from every player think once every ENEMY_LOD_INTERVAL ticks
+#ifndef ENEMY_LOD_INTERVAL
+#define ENEMY_LOD_INTERVAL 8
+#endif
+//covers how far a player can close in between two far updates
+#define ENEMY_LOD_MARGIN 8.0f
+
+//enemy animations are timed in ticks of this many per second of the enemy clock, the billboard shader counts the same ticks
+#define ANIM_TICK_RATE 60
+#define ANIM_TICKS(s) ((uint)lrintf((s) * ANIM_TICK_RATE))
+
+//props are static, so line of sight runs over a bit grid of their footprints built once with the world
+#define OCCUPANCY_CELLS_PER_UNIT 2
+#define OCCUPANCY_CELLS (MAP_SIZE * OCCUPANCY_CELLS_PER_UNIT)
+#define CHUNK_OCCUPANCY (CHUNK_SIZE * OCCUPANCY_CELLS_PER_UNIT)
+#define CHUNK_OCCUPANCY_WORDS ((CHUNK_OCCUPANCY + 63) / 64)
+#define PROP_RADIUS 0.5f
+//movement collides against props through a coarser grid, each collider sorted into the cell holding its centre
+#define COLLISION_CELL 4
+#define COLLISION_CELLS (MAP_SIZE / COLLISION_CELL)
+#define CHUNK_COLLISION (CHUNK_SIZE / COLLISION_CELL)
+#if CHUNK_SIZE % COLLISION_CELL
+#error CHUNK_SIZE must be a multiple of COLLISION_CELL
+#endif
+//both grids are only stored for chunks a prop's footprint reaches, so they cost what the props do and not what the map does
+//a footprint near a corner reaches up to four chunks
+#ifndef MAX_PROP_CHUNKS
+#define MAX_PROP_CHUNKS (WORLD_CHUNKS * WORLD_CHUNKS < MAX_PROPS * 4 ? WORLD_CHUNKS * WORLD_CHUNKS : MAX_PROPS * 4)
+#endif
+//open addressing, kept at most half full
+#define PROP_CHUNK_TABLE (MAX_PROP_CHUNKS * 2)
+//times a move may hit something and slide on with the rest of it
+#define COLLISION_SLIDES 3
+#define PLAYER_RADIUS 0.35f
+#define ENEMY_RADIUS 0.4f
+//hitscan weapons reach across the whole map unless a prop is in the way
+#define HITSCAN_RANGE (MAP_SIZE * 1.5f)
+//wandering enemies in detectRange only notice a player they can see, each rechecks every SIGHT_INTERVAL ticks
+//and no more than SIGHT_CHECKS_PER_TICK checks run in one tick, the rest keep their last answer and go first next time
+#define SIGHT_INTERVAL 4
+#ifndef SIGHT_CHECKS_PER_TICK
+#define SIGHT_CHECKS_PER_TICK 32
+#endif
+
+#define ARENA_ALIGN 16
+//text plus the per-frame light list and billboard buckets
+#define FRAME_ARENA_SIZE (64 * 1024 + (MAX_PROPS + MAX_ITEMS + MAX_ENEMIES + MAX_PROJECTILES + MAX_PLAYERS * 3) * 32)
+//every enemy of a wave could drop an item, plus leftovers carried over and the wave's ammo
+#define WAVE_ARENA_SIZE ((MAX_ENEMIES + MAX_ITEMS + 8) * ARENA_ALIGN)
 
 static RenderTexture2D canvas;
-static RenderTexture2D lightingTexture;
-static RenderTexture2D combinedTexture;
 //Assets
 static Texture2D texEnemies;
 static Texture2D texGround;
-static Texture2D texLight;
 static Texture2D texProps;
 static Texture2D texWeapons;
 static Texture2D texItems;
+static Texture2D texParticle;
 static Model mdSkybox;
 static Shader lightShader;
-static int lightmapULoc;
+static Shader sharpenShader;
+static int sharpenUvMaxULoc;
+static int sharpenAmountULoc;
+static int lightOriginULoc;
+static int lightCountULoc;
+static int lightPositionsULoc;
+static int lightColorsULoc;
+static int animTickULoc;
 static Sound revShoot;
 static Sound nadeExplosion;
 static Sound sgunShoot;
@@ -58,39 +260,188 @@ enum EnemyState {
     ES_Wander,
     ES_Pursue,
     ES_Attack,
+
+    ES_LAST_ENTRY,
+};
+
+enum EnemyLod {
+    EL_Full,
+    EL_Far,
+};
+
+enum SpawnKind {
+    SK_Enemy,
+    SK_Ammo,
 };
 
+enum MatchOutcome {
+    MO_None,
+    MO_GameOver,
+    MO_Win,
+};
+
+enum EffectKind {
+    EK_MuzzleFlash,
+    EK_Hit,
+    EK_Explosion,
+
+    EK_LAST_ENTRY,
+};
+
+//when the budget is full a new effect pushes out lower priorities, never its own or higher
+enum ParticlePriority {
+    PP_Flash,
+    PP_Hit,
+    PP_Explosion,
+
+    PP_LAST_ENTRY,
+};
+
+enum PacketType {
+    PK_Join,
+    PK_Welcome,
+    PK_Input,
+    PK_Snapshot,
+    PK_Leave,
+};
+
+struct player;
+struct game;
+
+//FIXED_SIM keeps the enemies' positions, headings and timers in fixed point between ticks and nothing else,
+//players, projectiles, items and the slide along props are float either way, so a match only replays the same
+//across builds compiled with -ffp-contract=off, make determinism builds both modes that way
+#ifdef FIXED_SIM
+//16.16, a 256 unit arena leaves plenty of headroom
+typedef int32_t fixed;
+#define FIXED_ONE 65536
+//unit headings in Q14, so a whole one still fits 16 bits
+#define HEADING_ONE 16384
+typedef struct {
+    fixed x, y;
+} FixedVector2;
+typedef struct {
+    int16_t x, y;
+} Heading;
+//seconds in 16.16, the clock is unsigned so the difference of two readings stays right when it wraps after 18 hours,
+//a single reading jumps back to 0 then, so nothing may be scaled from one
+typedef fixed simtime;
+typedef uint32_t simclock;
+#define SIM_SECONDS(s) ((simtime)lrint((s) * FIXED_ONE))
+#define SIM_TO_SECONDS(t) ((float)(t) / FIXED_ONE)
+#else
+typedef float simtime;
+typedef double simclock;
+#define SIM_SECONDS(s) (s)
+#define SIM_TO_SECONDS(t) (t)
+#endif
+
 typedef struct {
     bool unlocked;
     uint damage;
     uint ammo;
     uint ammoCap;
     uint frames;
-    uint curFrame;
-    double frameTimer;
-    double frameTime;
+    //a shot plays the frames once, from the last one down to the idle frame 0, timed in animation ticks like the enemies
+    uint animStart;
+    uint frameTicks;
+    //on frame 0, the drawn frame is worked out from the ticks
     Rectangle spriteRect;
-    void (*OnShoot)(void);
+    void (*OnShoot)(struct game*, struct player*);
 } Weapon;
 
+//there can be a lot of these, so the small fields are packed together
 typedef struct enemy{
     bool alive;
+    //whether the nearest player was in sight at the last check
+    bool seesTarget;
+    uint8_t type;
+    uint8_t state;
+    uint8_t lod;
+    uint8_t frames;
+    uint8_t frameTicks;
+    uint8_t speed;
     int health;
-    uint frames;
-    int curFrame;
-    double frameTimer;
-    double frameTime;
-    int state;
-    uint speed;
+    //index in EnemyGroups[type][state]
+    int group;
     float attackRange;
     float detectRange;
+    //animation tick the current cycle started on, frames count down from frames - 1 like the weapons
+    uint animStart;
+#ifdef FIXED_SIM
+    simtime spawnTimer;
+    simclock lastUpdate;
+    FixedVector2 position;
+    Heading velocity;
+#else
+    double lastUpdate;
+    float spawnTimer;
     Vector2 position;
     Vector2 velocity;
+#endif
     Rectangle spriteRect;
-    void (*OnAttack)(void);
-    void (*OnDeath)(struct enemy*);
 } Enemy;
 
+//everything outside the enemy update goes through these, so it never cares how the state is stored
+static inline Vector2 GetEnemyPosition(const Enemy* e) {
+#ifdef FIXED_SIM
+    return (Vector2){(float)e->position.x / FIXED_ONE, (float)e->position.y / FIXED_ONE};
+#else
+    return e->position;
+#endif
+}
+
+static inline void SetEnemyPosition(Enemy* e, Vector2 position) {
+#ifdef FIXED_SIM
+    e->position = (FixedVector2){(fixed)lrintf(position.x * FIXED_ONE), (fixed)lrintf(position.y * FIXED_ONE)};
+#else
+    e->position = position;
+#endif
+}
+
+//the heading is a unit vector or zero, the speed is kept apart
+static inline void SetEnemyHeading(Enemy* e, Vector2 heading) {
+#ifdef FIXED_SIM
+    e->velocity = (Heading){(int16_t)lrintf(heading.x * HEADING_ONE), (int16_t)lrintf(heading.y * HEADING_ONE)};
+#else
+    e->velocity = heading;
+#endif
+}
+
+//the cycle is over once every frame has had its ticks, signed so a start still in the future reads as running
+static inline bool IsEnemyCycleDone(const Enemy* e, uint now) {
+    return (int)(now - e->animStart) >= e->frames * e->frameTicks;
+}
+
+//puts the cycle on the given frame as of now
+static inline void SetEnemyFrame(Enemy* e, uint now, int frame) {
+    e->animStart = now - (e->frames - 1 - frame) * e->frameTicks;
+}
+
+//only the network needs the frame on the CPU, locally the billboard shader works it out
+static inline int GetEnemyFrame(const Enemy* e, uint now) {
+    if(!e->frameTicks || (int)(now - e->animStart) < 0) { return e->frames - 1; }
+    return e->frames - 1 - (int)((now - e->animStart) / e->frameTicks % e->frames);
+}
+
+//0 once the shot has played out and the weapon can fire again
+static inline int GetWeaponFrame(const Weapon* wep, uint now) {
+    uint elapsed = now - wep->animStart;
+    return elapsed >= (wep->frames - 1) * wep->frameTicks ? 0 : (int)(wep->frames - 1 - elapsed / wep->frameTicks);
+}
+
+//a wandering enemy due to look for the player it is closest to
+typedef struct {
+    int enemy;
+    int player;
+} SightCheck;
+
+//ids of the live enemies of one archetype in one state, in no particular order
+typedef struct {
+    int count;
+    int ids[MAX_ENEMIES];
+} EnemyGroup;
+
 typedef struct {
     bool active;
     Vector3 position;
@@ -102,7 +453,8 @@ typedef struct {
     Vector3 position;
     Rectangle spriteRect;
     void* data;
-    void (*OnPickUp)(void*);
+    uint dataSize;
+    void (*OnPickUp)(struct game*, struct player*, void*);
 } Item;
 
 typedef struct {
@@ -114,9 +466,342 @@ typedef struct {
 } Projectile;
 
 typedef struct {
-    double unpausedTime;
+    Vector2 rotation;   //absolute view angles in degrees
+    Vector2 move;       //x strafes left, y moves forward
+    uint fireCount;     //bumped on every trigger press so a lost packet can't eat a shot
+    int weaponSlot;     //-1 keeps the current weapon
+    uint overlayToggles;    //F3 presses, the latency overlay is up while it is odd, never leaves this machine
+} PlayerInput;
+
+typedef struct player {
+    bool active;
+    bool alive;
+    Vector2 position;
+    Vector2 velocity;
+    Vector2 rotation;
+    uint speed;
+    int health;
+    int healthMax;
+    uint selectedWeapon;
+    uint lastFireCount;
+    Weapon weapons[WT_LAST_ENTRY];
+    PlayerInput input;
+    //input comes from DriveBot instead of a device or the network
+    bool bot;
+    float botStrafe;
+} Player;
+
+//quantized entity as sent over the wire, slots are enemies then items then projectiles
+typedef struct {
+    unsigned char active;
+    unsigned char sprite;
+    int x, y, z;
+} NetEntity;
+
+typedef struct {
+    unsigned char active;
+    unsigned char alive;
+    unsigned char weapon;
+    int x, y;
+    int rotX, rotY;
+} NetPlayer;
+
+//state only the owning client receives
+typedef struct {
+    int health;
+    int healthMax;
+    uint selectedWeapon;
+    bool unlocked[WT_LAST_ENTRY];
+    uint ammo[WT_LAST_ENTRY];
+    uint ammoCap[WT_LAST_ENTRY];
+} NetSelf;
+
+typedef struct {
+    uint tick;
+    int outcome;
+    int wave;
+    int enemies;
+    int score;
+    NetSelf self;
+    NetPlayer players[MAX_PLAYERS];
+    NetEntity entities[NET_ENTITY_COUNT];
+} NetSnapshot;
+
+typedef struct {
+    bool connected;
+    NetAddress address;
+    int player;
+    double lastHeard;
+    uint lastInputSeq;
+    uint ackTick;
+    uint cursor;
+    uint bytesSent;
+} NetPeer;
+
+typedef struct {
+    NetSocket socket;
+    NetAddress server;
+    bool joined;
+    //the match snapshots are applied to, bots leave it NULL
+    struct game* world;
+    int player;
+    uint inputSeq;
+    uint latestTick;
+    double renderTick;
+    double lastJoin;
+    //welcome parts that arrived, the client keeps asking to join until none are missing
+    uint8_t welcomeSeen[(NET_WELCOME_PARTS + 7) / 8];
+    int welcomeMissing;
+    NetSnapshot* history;
+    uint bytesReceived;
+    uint snapshotsReceived;
+    uint snapshotsDropped;
+} NetClient;
+
+typedef struct {
+    int kind;
+    int type;
+    int amount;
+    Vector2 position;
+} SpawnRequest;
+
+//next wave's spawns, generated a few per tick ahead of time and drained a few per tick once it starts
+typedef struct {
+    SpawnRequest requests[SPAWN_QUEUE_SIZE];
+    int count;      //requests generated so far
+    int total;      //requests the wave needs
+    int enemies;    //how many of them are enemies
+    int next;       //next request to spawn while draining
+    int wave;       //wave the requests are for
+    bool draining;
+    float credit;
+} SpawnQueue;
+
+//bump allocator, everything in it dies together on ArenaReset
+typedef struct {
+    unsigned char* base;
+    size_t size;
+    size_t used;
+    size_t highWater;
+} Arena;
+
+//one laid out character, dest is relative to where the text is drawn and uv is on the default font texture
+typedef struct {
+    Rectangle dest;
+    Rectangle uv;
+} HudGlyph;
+
+//HUD string cached against the values it was formatted from, along with its glyph quads
+typedef struct {
+    bool valid;
+    int values[2];
+    int width;
+    char text[48];
+    int glyphCount;
+    HudGlyph glyphs[48];
+} HudText;
+
+//frame times while one wave is on screen, WAVE_STATS_BUCKETS wide histogram for the percentiles
+typedef struct {
+    int wave;
+    uint frames;
+    double intervalSum, intervalMax;
+    double workSum, workMax;
+    uint histogram[WAVE_STATS_BUCKETS];
+} WaveStats;
+
+enum MetricPool {
+    MP_Enemies,
+    MP_Projectiles,
+    MP_Items,
+    MP_Props,
+
+    MP_LAST_ENTRY,
+};
+
+//per-bucket counts, made cumulative when scraped
+typedef struct {
+    atomic_ullong buckets[METRICS_TIME_BUCKETS + 1];
+    atomic_ullong sumMicros;
+} MetricHistogram;
+
+//only ever touched with relaxed atomics, a scrape may see one counter a tick ahead of another but never holds anything up
+typedef struct {
+    atomic_ullong spawned[MP_LAST_ENTRY];
+    atomic_ullong dropped[MP_LAST_ENTRY];
+    atomic_ullong enemiesKilled;
+    atomic_ullong soundEvents;
+    atomic_ullong soundEventsDropped;
+    atomic_uint live[MP_LAST_ENTRY];
+    atomic_uint wave;
+    atomic_uint particles;
+    atomic_uint particleBudget;
+    atomic_ullong particlesCulled;
+    MetricHistogram frameTime;
+    MetricHistogram tickTime;
+} Metrics;
+
+typedef struct {
+    NetSocket socket;
+    double opened;
+    int received;
+    char request[512];
+} MetricsConnection;
+
+//a chunk near the viewer, its ground tile and the lights assigned to it, indices into the frame's light list
+typedef struct {
+    int cx, cy;
+    //groundTiles slot, -1 until it is baked
+    int tile;
+    int lightCount;
+    int lights[LIGHTS_PER_CHUNK];
+} Chunk;
+
+//the texture stays allocated once the slot is first used, later bakes are uploaded over it
+typedef struct {
+    int cx, cy;
+    bool baked;
+    uint lastUsed;
+    Texture2D texture;
+} GroundTile;
+
+//sight and collision cells of one chunk with props in it
+typedef struct {
+    int cx, cy;
+    uint64_t occupancy[CHUNK_OCCUPANCY][CHUNK_OCCUPANCY_WORDS];
+    //prop centres sorted by collision cell, local cell c holds colliders[collisionStart[c]] up to colliders[collisionStart[c + 1]]
+    int collisionStart[CHUNK_COLLISION * CHUNK_COLLISION + 1];
+} PropChunk;
+
+//the last chunk a walk over the grids looked up, most steps stay inside it
+typedef struct {
+    int cx, cy;
+    const PropChunk* chunk;
+} PropChunkCursor;
+
+//the same for the sight cells, by the first cell of the chunk
+typedef struct {
+    int x0, y0;
+    const PropChunk* chunk;
+} OccupancyCursor;
+
+//point light on the ground plane, color is premultiplied by its strength
+typedef struct {
+    Vector2 position;
+    float radius;
+    Vector3 color;
+} PointLight;
+
+enum SpriteSheet {
+    SS_Props,
+    SS_Items,
+    SS_Enemies,
+};
+
+typedef struct {
+    Vector3 position;
+    Rectangle source;
+    float size;
+    int sheet;
+    //WHITE for a still sprite, otherwise frames, ticks per frame and the low 16 bits of the start tick for prop.vs
+    Color anim;
+} RenderSprite;
+
+//played by the main thread, pitch and volume are rolled when the simulation queues it
+typedef struct {
+    Sound sound;
+    float pitch;
+    float volume;
+} SoundEvent;
+
+typedef struct {
+    int kind;
+    Vector3 position;
+    Vector3 direction;
+} EffectEvent;
+
+typedef struct {
+    int count;
+    int priority;
+    float speed;
+    //0 keeps to the direction, 1 scatters over the whole sphere
+    float spread;
+    float lifetime;
+    float size;
+    float gravity;
+    Color color;
+} EffectStyle;
+
+//structure of arrays so integration is straight float loops the compiler can vectorize
+typedef struct {
+    int count;
+    //live limit, below PARTICLE_BUDGET while particles cost more than their share of the frame
+    int budget;
+    int perPriority[PP_LAST_ENTRY];
+    float px[PARTICLE_BUDGET], py[PARTICLE_BUDGET], pz[PARTICLE_BUDGET];
+    float vx[PARTICLE_BUDGET], vy[PARTICLE_BUDGET], vz[PARTICLE_BUDGET];
+    float gravity[PARTICLE_BUDGET];
+    float life[PARTICLE_BUDGET];
+    float invLifetime[PARTICLE_BUDGET];
+    float size[PARTICLE_BUDGET];
+    Color color[PARTICLE_BUDGET];
+    unsigned char priority[PARTICLE_BUDGET];
+} ParticleSystem;
+
+//per frame, the costs are CPU time on the main thread
+typedef struct {
+    int emitted;
+    int culled;
+    int dropped;
+    double updateTime;
+    double drawTime;
+    double costAvg;
+} ParticleStats;
+
+//what one simulation tick hands to the renderer, the renderer never touches the entity pools
+typedef struct {
+    Vector2 viewPosition;
+    float viewBobbing;
+    Vector2 viewRotation;
+    int spriteCount;
+    RenderSprite sprites[BILLBOARD_COUNT];
+    int projectileCount;
+    Vector3 projectiles[MAX_PROJECTILES];
+    int playerCount;
+    Vector2 players[MAX_PLAYERS];
+    int lightCount;
+    PointLight lights[LIGHT_SOURCE_COUNT];
+    int soundCount;
+    SoundEvent sounds[MAX_SOUND_EVENTS];
+    int effectCount;
+    EffectEvent effects[MAX_EFFECT_EVENTS];
+    uint animTick;
+    Rectangle weaponRect;
+    int ammo, ammoCap;
+    int health, healthMax;
+    int enemies, wave, score;
+    int outcome;
+    size_t waveArenaHighWater;
+    Ray debugRays[8];
+} RenderSnapshot;
+
+//runs one UpdateSimulation per kick on its own thread while the main thread renders the previous tick
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool running;
+    bool busy;
+    bool quit;
+    struct game* game;
+    PlayerInput input;
+    float deltaTime;
+    int steps;
+    RenderSnapshot* target;
+} SimWorker;
+
+typedef struct {
     double totalTime;
-    double deltaTime;
     void (*UpdateFunc)(void);
     void (*DrawFunc)(void);
     Music currentMusic;
@@ -124,63 +809,195 @@ typedef struct {
     bool isUnfocused;
 } GameState;
 
+//one whole match, every update function works on the one it is handed so any number can run side by side
+typedef struct game {
+    double unpausedTime;
+    double deltaTime;
+    int outcome;
+    //new players get every weapon
+    bool debug;
+    //the player sounds are heard from, -1 when nobody listens
+    int localPlayer;
+    int curMaxEnemies;
+    int curEnemies;
+    int curWave;
+    int score;
+    uint64_t rng;
+    Prop Props[MAX_PROPS];
+    Enemy Enemies[MAX_ENEMIES];
+    Projectile Projectiles[MAX_PROJECTILES];
+    Item Items[MAX_ITEMS];
+    Player Players[MAX_PLAYERS];
+    int FreeEnemySlots[MAX_ENEMIES];
+    int freeEnemyCount;
+    EnemyGroup EnemyGroups[ET_LAST_ENTRY][ES_LAST_ENTRY];
+    //time and ticks seen by UpdateEnemies, far enemies catch up on the time since their lastUpdate
+    simclock enemyClock;
+    uint enemyTick;
+#ifdef FIXED_SIM
+    //the same time in 64 bits, which never wraps, animation ticks are scaled from it and wrap with their own type
+    uint64_t animClock;
+#endif
+    //the sight checks of this tick, the first SIGHT_CHECKS_PER_TICK due enemies by slot counting on from the tick's cursor
+    SightCheck sightQueue[SIGHT_CHECKS_PER_TICK];
+    int sightQueued;
+    bool sightDropped;
+    //every SIGHT_INTERVAL'th tick checks the same slots, the cursor of each resumes after the last one it got to
+    int sightCursor[SIGHT_INTERVAL];
+    int propChunkCount;
+    PropChunk propChunks[MAX_PROP_CHUNKS];
+    //propChunks index + 1 by chunk hash, 0 for an empty slot
+    int propChunkTable[PROP_CHUNK_TABLE];
+    Vector2 colliders[MAX_PROPS];
+    SpawnQueue spawnQueue;
+    _Alignas(ARENA_ALIGN) unsigned char waveMemory[2][WAVE_ARENA_SIZE];
+    Arena waveArenas[2];
+    int waveArena;
+    SoundEvent soundQueue[MAX_SOUND_EVENTS];
+    int soundQueueCount;
+    EffectEvent effectQueue[MAX_EFFECT_EVENTS];
+    int effectQueueCount;
+    //one hit sound per enemy per tick, however many pellets land
+    const Enemy* lastHitEnemy;
+    double lastHitTime;
+    Ray debugRays[8];
+} Game;
+
+static inline uint GetAnimTick(const Game* g) {
+#ifdef FIXED_SIM
+    return (uint)(g->animClock * ANIM_TICK_RATE >> 16);
+#else
+    return (uint)(uint64_t)(g->enemyClock * ANIM_TICK_RATE);
+#endif
+}
+
+static inline void AdvanceAnimClock(Game* g, simtime dt) {
+    g->enemyClock += dt;
+#ifdef FIXED_SIM
+    g->animClock += dt;
+#endif
+}
+
+typedef struct {
+    uint seed;
+    uint ticks;
+    int wave;
+    int score;
+    int outcome;
+    //HashGame of the final state, equal across builds as long as the match played out the same
+    uint64_t state;
+    double seconds;
+} BatchSession;
+
+//sessions are handed out one at a time so a long match doesn't hold up a whole share of the batch
+typedef struct {
+    pthread_mutex_t lock;
+    BatchSession* sessions;
+    int count;
+    int next;
+    uint ticks;
+} BatchRun;
+
 #define MAX(x,y) x > y ? x : y
 #define MIN(x,y) x < y ? x : y
 
-void PlaySoundRPitch(Sound sound);
-void PlaySoundRPitchDirectional(Sound sound, Vector2 source);
-void OnShootLaser(void);
-void OnShootLauncher(void);
-void OnShootShotgun(void);
-void OnAttackAmogus(void);
-void OnDeathAmogus(Enemy* e);
+void PlaySoundRPitch(Game* g, Sound sound);
+void PlaySoundRPitchDirectional(Game* g, Sound sound, Vector2 source);
+void PlaySoundFromPlayer(Game* g, Sound sound, const Player* p);
+void OnShootLaser(Game* g, Player* p);
+void OnShootLauncher(Game* g, Player* p);
+void OnShootShotgun(Game* g, Player* p);
+void OnAttackAmogus(Game* g, Player* p);
+void OnDeathAmogus(Game* g, Enemy* e);
+//behaviour per archetype, expanded into the enemy update loops and death handling
+#define ENEMY_ARCHETYPES(X) \
+    X(ET_Amogus, OnAttackAmogus, OnDeathAmogus) \
+    X(ET_Impostor, OnAttackAmogus, OnDeathAmogus)
 void Update(void);
-void UpdateView(void);
-void UpdateWeapon(void);
-void UpdateEnemies(void);
-void UpdateEnemy(Enemy* e);
+void UpdateClient(void);
+void UpdateSimulation(Game* g);
+void UpdatePlayer(Game* g, Player* p);
+PlayerInput DriveBot(Game* g, Player* p);
+void UpdateViewCamera(Vector2 position, float bobbing, Vector2 rotation);
+PlayerInput PollLocalInput(PlayerInput in);
+void LatchLocalInput(void);
+void RecordPresent(void);
+void RecordWaveFrame(const RenderSnapshot* r);
+void ReportWaveStats(const WaveStats* w);
+void PaceFrame(void);
+void UpdatePlayerWeapon(Game* g, Player* p);
+void UpdateEnemies(Game* g);
 void UpdateWin(void);
 void UpdateGameOver(void);
-void DrawScene(void);
-void DrawEnemies(void);
-void DrawWeapon(void);
+void DrawScene(const RenderSnapshot* r);
+void DrawWeapon(const RenderSnapshot* r);
 void DrawSkybox(void);
-void DrawUI(void);
-void DrawProjectiles(void);
+void DrawUI(const RenderSnapshot* r);
+void DrawProjectiles(const RenderSnapshot* r);
+void DrawPlayers(const RenderSnapshot* r);
 void Draw(void);
 void DrawGameOver(void);
 void DrawWin(void);
-void RenderLightTexture(void);
+void AssignLights(const RenderSnapshot* r);
+void BuildRenderSnapshot(Game* g, RenderSnapshot* r);
+void PlaySoundEvents(const RenderSnapshot* r);
+void QueueEffect(Game* g, int kind, Vector3 position, Vector3 direction);
+void RunEffects(const RenderSnapshot* r);
+void DrawParticles(void);
+void StartSimWorker(SimWorker* w, Game* g);
+void KickSimWorker(SimWorker* w, PlayerInput input, float deltaTime, int steps, RenderSnapshot* target);
+void WaitSimWorker(SimWorker* w);
+void StopSimWorker(SimWorker* w);
+void UpdateVisibleChunks(Vector2 viewer);
+void StreamGroundTiles(const RenderSnapshot* r);
 void LoadAssets(void);
 void UnloadAssets(void);
-void SpawnEnemy(int type, float x, float y);
-void SpawnProp(int id, float x, float y);
-void DeleteItems(void);
-void SpawnProjectile(float x, float y, Vector3 velocity, int dmg, uint spd);
-void SpawnAmmo(int weapon, int amount, float x, float y);
-void SpawnWeapon(int weapon, float x, float y);
-void SpawnRandomItem(int mod, float x, float y);
-
-static Vector2 playerPos = {0,0};
-static Vector2 playerVel = {0,0};
-static Vector2 rotation = {0,0};
-static uint playerSpeed = 20;
-static int playerHealth = 100;
-static int playerHealthMax = 100;
-static uint selectedWeapon = 0;
+void LoadGpuTimer(void);
+void UnloadGpuTimer(void);
+void SpawnEnemy(Game* g, int type, float x, float y);
+void SpawnProp(Game* g, int id, float x, float y);
+void SpawnWorld(Game* g);
+void InitPlayer(Game* g, Player* p, int id);
+void DeleteItems(Game* g);
+void SpawnProjectile(Game* g, float x, float y, Vector3 velocity, int dmg, uint spd);
+void SpawnAmmo(Game* g, int weapon, int amount, float x, float y);
+void SpawnWeapon(Game* g, int weapon, float x, float y);
+void SpawnRandomItem(Game* g, int mod, float x, float y);
+void RebuildEnemyLists(Game* g);
+void RemoveEnemyFromGroup(Game* g, Enemy* e);
+void UpdateSpawns(Game* g);
+void BuildOccupancy(Game* g);
+float TraceOccupancy(const Game* g, Vector2 from, Vector2 to);
+bool HasLineOfSight(const Game* g, Vector2 from, Vector2 to);
+float GetHitscanReach(const Game* g, Ray ray);
+void BuildCollision(Game* g);
+bool SweepCircle(const Game* g, Vector2 pos, Vector2 delta, float radius, float* hitTime, Vector2* hitNormal);
+Vector2 MoveCircle(const Game* g, Vector2 from, Vector2 delta, float radius);
+float GetEnemyHeight(const Enemy* e);
+void* ArenaAlloc(Arena* a, size_t size);
+void ArenaReset(Arena* a);
+void ReportArenas(const Game* g);
+Game* NewGame(uint seed);
+void FreeGame(Game* g);
+int GetGameRandom(Game* g, int min, int max);
+void ObserveMetricTime(MetricHistogram* h, double seconds);
+void PublishGameMetrics(const Game* g);
+void ServeMetrics(void);
+uint64_t HashGame(const Game* g);
+
+#define METRIC_ADD(counter, n) atomic_fetch_add_explicit(&metrics.counter, (n), memory_order_relaxed)
+
 static int curMusic = 0;
-static Vector2 mouseDelta = {0,0};
-static Vector2 mouseSensitivity = {20.0,10.0};
-static Weapon Weapons[WT_LAST_ENTRY] = {
+//degrees per mouse count, independent of the frame rate
+static Vector2 mouseSensitivity = {0.33f, 0.17f};
+static const Weapon WeaponDefaults[WT_LAST_ENTRY] = {
     {
         .unlocked = true,
         .damage = 50,
         .ammo = 66,
         .ammoCap = 300,
         .frames = 3,
-        .curFrame = 0,
-        .frameTimer = 0,
-        .frameTime = 0.2,
+        .frameTicks = ANIM_TICK_RATE / 5,
         .spriteRect = {0, 0, 64, 120},
         .OnShoot = &OnShootLaser,
     },
@@ -190,9 +1007,7 @@ static Weapon Weapons[WT_LAST_ENTRY] = {
         .ammo = 5,
         .ammoCap = 50,
         .frames = 3,
-        .curFrame = 0,
-        .frameTimer = 0,
-        .frameTime = 0.5,
+        .frameTicks = ANIM_TICK_RATE / 2,
         .spriteRect = {0, 120, 100, 120},
         .OnShoot = &OnShootLauncher,
     },
@@ -202,18 +1017,100 @@ static Weapon Weapons[WT_LAST_ENTRY] = {
         .ammo = 22,
         .ammoCap = 100,
         .frames = 3,
-        .curFrame = 0,
-        .frameTimer = 0,
-        .frameTime = 0.3,
+        .frameTicks = ANIM_TICK_RATE * 3 / 10,
         .spriteRect = {0, 240, 100, 120},
         .OnShoot = &OnShootShotgun,
     },
 };
 
-static Prop Props[MAX_PROPS] = {0};
-static Enemy Enemies[MAX_ENEMIES] = {0};
-static Projectile Projectiles[MAX_PROJECTILES] = {0};
-static Item Items[MAX_ITEMS] = {0};
+//the match the window shows, simulated locally or mirrored from a server
+static Game* game = NULL;
+//the local player is driven by DriveBot, the window only watches
+static bool botPlayer = false;
+//simulation ticks per frame, above 1 fast-forwards
+static int simSpeed = 1;
+static bool exitRequested = false;
+static WaveStats waveStats = { .wave = -1 };
+static ParticleSystem particles = { .budget = PARTICLE_BUDGET };
+static ParticleStats particleStats;
+static uint32_t particleRng = 0x2545F491;
+static const EffectStyle EffectStyles[EK_LAST_ENTRY] = {
+    [EK_MuzzleFlash] = { .count = 10, .priority = PP_Flash, .speed = 3.0f, .spread = 0.35f, .lifetime = 0.07f, .size = 0.12f, .gravity = 0, .color = {255, 214, 140, 255} },
+    [EK_Hit] = { .count = 14, .priority = PP_Hit, .speed = 3.5f, .spread = 0.9f, .lifetime = 0.35f, .size = 0.14f, .gravity = 1.0f, .color = {210, 40, 30, 255} },
+    [EK_Explosion] = { .count = 120, .priority = PP_Explosion, .speed = 9.0f, .spread = 1.0f, .lifetime = 0.8f, .size = 0.55f, .gravity = 0.4f, .color = {255, 150, 50, 255} },
+};
+
+static Metrics metrics;
+static NetSocket metricsSocket = -1;
+static MetricsConnection metricsConnections[METRICS_MAX_CONNECTIONS];
+static const char* MetricPoolNames[MP_LAST_ENTRY] = {"enemies", "projectiles", "items", "props"};
+static const int MetricPoolCapacity[MP_LAST_ENTRY] = {MAX_ENEMIES, MAX_PROJECTILES, MAX_ITEMS, MAX_PROPS};
+//upper bounds in seconds, the +Inf bucket comes on top
+static const double MetricTimeBuckets[METRICS_TIME_BUCKETS] = {0.001, 0.002, 0.004, 0.008, 0.0167, 0.0333, 0.05, 0.1};
+
+static NetSocket serverSocket = -1;
+static NetPeer Peers[MAX_PLAYERS] = {0};
+static NetSnapshot PeerHistory[MAX_PLAYERS][NET_HISTORY];
+static NetSnapshot netCurrent;
+static NetSnapshot netSent;
+static NetSnapshot netEmpty = {0};
+static NetClient netClient = { .socket = -1 };
+static int netDesiredWeapon = -1;
+
+static _Alignas(ARENA_ALIGN) unsigned char frameMemory[FRAME_ARENA_SIZE];
+static Arena frameArena = { frameMemory, FRAME_ARENA_SIZE };
+
+//every chunk within RESIDENT_RADIUS nearest first, the first visibleChunkCount are lit
+static Chunk Chunks[VIEW_CHUNKS * VIEW_CHUNKS];
+static int visibleChunkCount = 0;
+static int residentChunkCount = 0;
+static GroundTile groundTiles[MAX_RESIDENT_CHUNKS];
+static uint groundFrame = 0;
+//hash of the prop positions the tiles were baked with, props only change with the world
+static uint64_t groundProps = 0;
+static Image groundImage;
+static Color tileTexels[CHUNK_TEXELS * CHUNK_TEXELS];
+//visible index (or 0xFF) per chunk of the window starting at viewOrigin
+static unsigned char viewWindow[VIEW_CHUNKS * VIEW_CHUNKS];
+static int viewOriginX = 0, viewOriginY = 0;
+static const PointLight* frameLights = NULL;
+
+//the main thread draws renderSnapshots[renderFront] while the worker fills the other one
+static RenderSnapshot renderSnapshots[2];
+static int renderFront = 0;
+static SimWorker simWorker = {0};
+//owned by the main thread, the simulation gets a copy with every tick
+static PlayerInput localInput = {.weaponSlot = -1};
+//FRAME_RATE_VSYNC, FRAME_RATE_UNCAPPED or a paced cap in frames per second
+static int frameRate = FRAME_RATE_VSYNC;
+static double frameInterval = 0;
+static double nextFrameTime = 0;
+static double inputLatchTime = 0;
+static double latencySamples[LATENCY_SAMPLES];
+static int latencySampleCount = 0;
+static double frameBudget = 1.0 / RENDER_SCALE_FALLBACK_FPS;
+static double frameStartTime = 0;
+//until the frame is submitted, and until EndDrawing returns
+static double frameCpuTime = 0;
+static double frameWorkTime = 0;
+static double frameCpuAvg = 0;
+static double presentTime = 0;
+static double presentInterval = 0;
+static double frameWorkAvg = 0;
+//measured by GL_TIME_ELAPSED queries when the context has them
+static bool gpuTimerReady = false;
+static unsigned int gpuQueries[GPU_TIMER_QUERIES];
+static bool gpuQueryPending[GPU_TIMER_QUERIES];
+static int gpuQueryNext = 0;
+static int gpuQueryActive = -1;
+static double gpuFrameAvg = 0;
+static float renderScale = 1.0f;
+static int renderScaleHold = 0;
+
+static rlRenderBatch hudBatch;
+static HudText hudFps, hudAmmo, hudHealth, hudEnemies, hudWave, hudScore, hudStats, hudMemory, hudChunks, hudLatency, hudRender, hudParticles;
+static double hudCpuTime = 0;
+static int hudDrawCalls = 0;
 
 
 GameState state;
@@ -222,14 +1119,8 @@ Camera3D cam = {
     .up = {0,1,0},
     .projection = CAMERA_PERSPECTIVE,
 };
-int curMaxEnemies = 10;
-int curEnemies = 10;
-int curWave = 0;
-int score = 0;
 bool debug = false;
 
-Ray debugRays[8] = {0};
-
 //get fade out volume
 float GetMusicAdaptiveVolume(const Music* m) {
     float l = GetMusicTimeLength(*m);
@@ -245,40 +1136,106 @@ float GetMusicAdaptiveVolume(const Music* m) {
     return v;
 }
 
-int startGame(bool drawDebug)
-{
-    debug = drawDebug;
-    if (debug) {
-        Weapons[1].unlocked = true;
-        Weapons[2].unlocked = true;
+//a match before anyone joins or anything spawns, the wave arenas point into the game so it can't be copied afterwards
+Game* NewGame(uint seed) {
+    Game* g = calloc(1, sizeof(Game));
+    if(!g) { return NULL; }
+    g->localPlayer = -1;
+    g->curMaxEnemies = 10;
+    g->curEnemies = 10;
+    g->spawnQueue.wave = -1;
+    //xorshift must never be seeded with zero
+    g->rng = ((uint64_t)seed << 1 | 1) * 0x9E3779B97F4A7C15ull;
+    for(int i = 0; i < 2; i++) {
+        g->waveArenas[i] = (Arena){ g->waveMemory[i], WAVE_ARENA_SIZE };
     }
-    // Initialization
-    //--------------------------------------------------------------------------------------
+    return g;
+}
+
+void FreeGame(Game* g) {
+    if(!g) { return; }
+    DeleteItems(g);
+    free(g);
+}
+
+//same contract as GetRandomValue, but from the game's own xorshift64 so matches on other threads don't share a sequence
+int GetGameRandom(Game* g, int min, int max) {
+    if(min > max) {
+        int t = min;
+        min = max;
+        max = t;
+    }
+    g->rng ^= g->rng << 13;
+    g->rng ^= g->rng >> 7;
+    g->rng ^= g->rng << 17;
+    return min + (int)(g->rng % ((uint64_t)(max - min) + 1));
+}
+
+void InitPlayer(Game* g, Player* p, int id) {
+    *p = (Player){
+        .active = true,
+        .alive = true,
+        .position = {(id % 4) * 2.0f, (id / 4) * 2.0f},
+        .speed = 20,
+        .health = 100,
+        .healthMax = 100,
+        .input = {.weaponSlot = -1},
+    };
+    memcpy(p->weapons, WeaponDefaults, sizeof(p->weapons));
+    //every weapon starts out with its shot played out
+    for(int w = 0; w < WT_LAST_ENTRY; w++) {
+        p->weapons[w].animStart = GetAnimTick(g) - (p->weapons[w].frames - 1) * p->weapons[w].frameTicks;
+    }
+    if (g->debug) {
+        p->weapons[1].unlocked = true;
+        p->weapons[2].unlocked = true;
+    }
+}
+
+void SpawnWorld(Game* g) {
+    RebuildEnemyLists(g);
+    for(int i = 0; i < g->curMaxEnemies; i++) {
+        SpawnEnemy(g, ET_Amogus, GetGameRandom(g, -SPAWN_EXTENT, SPAWN_EXTENT), GetGameRandom(g, -SPAWN_EXTENT, SPAWN_EXTENT));
+    }
+    for(int i = 0; i < MAX_PROPS; i++) {
+        SpawnProp(g, GetGameRandom(g, 1, 10), GetGameRandom(g, -SPAWN_EXTENT, SPAWN_EXTENT), GetGameRandom(g, -SPAWN_EXTENT, SPAWN_EXTENT));
+    }
+    BuildOccupancy(g);
+    BuildCollision(g);
+}
+
+void OpenGameWindow(void) {
     const int screenWidth = 1280;
     const int screenHeight = 720;
-    SetConfigFlags(FLAG_VSYNC_HINT);
+    SetConfigFlags(frameRate == FRAME_RATE_VSYNC ? FLAG_VSYNC_HINT : 0);
     InitWindow(screenWidth, screenHeight, "Sus Shooter WIP");
     InitAudioDevice();
     DisableCursor();
     LoadAssets();
-    
-    for(int i = 0; i < curMaxEnemies; i++) {
-        SpawnEnemy(ET_Amogus, GetRandomValue(-90, 90), GetRandomValue(-90, 90));
-    }
-    for(int i = 0; i < MAX_PROPS; i++) {
-        SpawnProp(GetRandomValue(1, 10), GetRandomValue(-90, 90), GetRandomValue(-90, 90));
-    }
+}
 
-    state.DrawFunc = &Draw;
-    state.UpdateFunc = &Update;
+void RunGameLoop(void) {
     curMusic = GetRandomValue(0, 2);
     PlayMusicStream(lvl[curMusic]);
-    SetTargetFPS(60);
+    //raylib's own limiter would wait before polling input and stack with vsync, the pacer waits after it
+    SetTargetFPS(0);
+    if(frameRate > 0) {
+        frameInterval = 1.0 / frameRate;
+        frameBudget = frameInterval;
+    }
+    else if(frameRate == FRAME_RATE_VSYNC) {
+        //only kicks in when the driver ignores the vsync hint, a bit above refresh so it never stacks with it
+        int refresh = GetMonitorRefreshRate(GetCurrentMonitor());
+        frameBudget = 1.0 / (refresh > 0 ? refresh : RENDER_SCALE_FALLBACK_FPS);
+        frameInterval = frameBudget / 1.05;
+    }
+    nextFrameTime = GetTime();
     //--------------------------------------------------------------------------------------
 
     // Main game loop
-    while (!WindowShouldClose())
+    while (!WindowShouldClose() && !exitRequested)
     {
+        frameStartTime = GetTime();
         // Update
         //----------------------------------------------------------------------------------
         state.UpdateFunc();
@@ -287,155 +1244,246 @@ int startGame(bool drawDebug)
         // Draw
         //----------------------------------------------------------------------------------
         state.DrawFunc();
+        //EndDrawing just polled, take that in before anything polls again
+        localInput = PollLocalInput(localInput);
+        RecordPresent();
+        if(presentInterval > 0) { ObserveMetricTime(&metrics.frameTime, presentInterval); }
+        ServeMetrics();
+        if(botPlayer) { RecordWaveFrame(&renderSnapshots[renderFront]); }
+        ArenaReset(&frameArena);
+        PaceFrame();
         //----------------------------------------------------------------------------------
     }
 
     // De-Initialization
     //--------------------------------------------------------------------------------------
-    DeleteItems();
+    StopSimWorker(&simWorker);
+    ReportArenas(game);
+    FreeGame(game);
+    game = NULL;
     StopMusicStream(lvl[curMusic]);
     UnloadAssets();
     CloseAudioDevice();
     CloseWindow();        // Close window and OpenGL context
     //--------------------------------------------------------------------------------------
+}
+
+int startGame(bool drawDebug, int fps, bool bot, int speed)
+{
+    debug = drawDebug;
+    frameRate = fps;
+    botPlayer = bot;
+    simSpeed = speed > 1 ? speed : 1;
+    // Initialization
+    //--------------------------------------------------------------------------------------
+    OpenGameWindow();
+    game = NewGame((uint)time(NULL));
+    game->debug = drawDebug;
+    game->localPlayer = 0;
+    InitPlayer(game, &game->Players[game->localPlayer], game->localPlayer);
+    game->Players[game->localPlayer].bot = bot;
+    localInput = game->Players[game->localPlayer].input;
+    SpawnWorld(game);
+    //stands in for the tick the first Update collects
+    BuildRenderSnapshot(game, &renderSnapshots[!renderFront]);
+    StartSimWorker(&simWorker, game);
 
+    state.DrawFunc = &Draw;
+    state.UpdateFunc = &Update;
+    RunGameLoop();
     return 0;
 }
 
-void AddAmmo(int weapon, int amount) {
-    Weapons[weapon].ammo += amount;
-    if(Weapons[weapon].ammo > Weapons[weapon].ammoCap) {
-        Weapons[weapon].ammo = Weapons[weapon].ammoCap;
+void AddAmmo(Player* p, int weapon, int amount) {
+    Weapon* w = &p->weapons[weapon];
+    w->ammo += amount;
+    if(w->ammo > w->ammoCap) {
+        w->ammo = w->ammoCap;
     }
 }
 
-void HealPlayer(int hp) {
-    playerHealth += hp;
-    if(playerHealth > playerHealthMax) {
-        playerHealth = playerHealthMax;
+void HealPlayer(Player* p, int hp) {
+    p->health += hp;
+    if(p->health > p->healthMax) {
+        p->health = p->healthMax;
     }
 }
 
-void ChangeAmmoCap(int weapon, int amount) {
-    Weapons[weapon].ammoCap += amount;
-    if(Weapons[weapon].ammoCap < 10) {
-        Weapons[weapon].ammoCap = 10;
+void ChangeAmmoCap(Player* p, int weapon, int amount) {
+    Weapon* w = &p->weapons[weapon];
+    w->ammoCap += amount;
+    if(w->ammoCap < 10) {
+        w->ammoCap = 10;
     }
-    if(Weapons[weapon].ammo > Weapons[weapon].ammoCap) {
-        Weapons[weapon].ammo = Weapons[weapon].ammoCap;
+    if(w->ammo > w->ammoCap) {
+        w->ammo = w->ammoCap;
     }
 }
 
-void ChangePlayerMaxHp(int amount) {
-    playerHealthMax += amount;
-    if(playerHealthMax < 3) {
-        playerHealthMax = 3;
+void ChangePlayerMaxHp(Player* p, int amount) {
+    p->healthMax += amount;
+    if(p->healthMax < 3) {
+        p->healthMax = 3;
     }
-    if(playerHealth > playerHealthMax){
-        playerHealth = playerHealthMax;
+    if(p->health > p->healthMax){
+        p->health = p->healthMax;
     }
 }
 
-void OnPickUpAmmo(void* data) {
+void OnPickUpAmmo(Game* g, Player* p, void* data) {
     int* d = (int*)data;
-    AddAmmo(d[0], d[1]);
+    AddAmmo(p, d[0], d[1]);
 }
 
-void OnPickUpWeapon(void* data) {
+void OnPickUpWeapon(Game* g, Player* p, void* data) {
     int* d = (int*)data;
-    Weapons[d[0]].unlocked = true;
-    AddAmmo(d[0], 1);
+    p->weapons[d[0]].unlocked = true;
+    AddAmmo(p, d[0], 1);
 }
 
-void OnPickUpAmmoBag(void* data) {
+void OnPickUpAmmoBag(Game* g, Player* p, void* data) {
     int* d = (int*)data;
-    ChangeAmmoCap(d[0], d[1]);
+    ChangeAmmoCap(p, d[0], d[1]);
 }
 
-void OnPickUpMedkit(void* data) {
+void OnPickUpMedkit(Game* g, Player* p, void* data) {
     int* d = (int*)data;
-    HealPlayer(d[0]);
+    HealPlayer(p, d[0]);
 }
 
-void OnPickUpMaxHP(void* data) {
+void OnPickUpMaxHP(Game* g, Player* p, void* data) {
     int* d = (int*)data;
-    ChangePlayerMaxHp(d[0]);
+    ChangePlayerMaxHp(p, d[0]);
+}
+
+bool IsLocalPlayer(const Game* g, const Player* p) {
+    return g->localPlayer >= 0 && p == &g->Players[g->localPlayer];
 }
 
-void DamageEnemy(Enemy* e, uint dmg) {
-    static const Enemy* lastTarget = NULL;
-    static double lastCalled = 0;
+Player* GetNearestPlayer(Game* g, Vector2 pos, float* distance) {
+    Player* nearest = NULL;
+    float best = 0;
+    for(int i = 0; i < MAX_PLAYERS; i++) {
+        if(!g->Players[i].active || !g->Players[i].alive) { continue; }
+        float d = Vector2Distance(pos, g->Players[i].position);
+        if(!nearest || d < best) {
+            nearest = &g->Players[i];
+            best = d;
+        }
+    }
+    if(distance) { *distance = best; }
+    return nearest;
+}
+
+Vector3 GetAimDirection(Vector2 rotation) {
+    Quaternion Q = QuaternionMultiply(
+        QuaternionFromAxisAngle((Vector3){0, 1, 0}, rotation.y * DEG2RAD),
+        QuaternionFromAxisAngle((Vector3){1, 0, 0}, rotation.x * DEG2RAD));
+    return Vector3RotateByQuaternion((Vector3){0, 0, 1}, Q);
+}
+
+Ray GetPlayerAimRay(const Player* p) {
+    return (Ray){
+        .position = {p->position.x, 1, p->position.y},
+        .direction = GetAimDirection(p->rotation),
+    };
+}
+
+void DamageEnemy(Game* g, Enemy* e, uint dmg) {
     if(!e->alive) { return; }
     e->health -= dmg;
-    if(lastTarget != e || lastCalled != state.unpausedTime)
-        PlaySoundRPitchDirectional(enemyHit, e->position);
+    //back to full rate on the very next tick
+    e->lod = EL_Full;
+    if(g->lastHitEnemy != e || g->lastHitTime != g->unpausedTime)
+        PlaySoundRPitchDirectional(g, enemyHit, GetEnemyPosition(e));
+    QueueEffect(g, EK_Hit, (Vector3){GetEnemyPosition(e).x, 1, GetEnemyPosition(e).y}, (Vector3){0, 1, 0});
     if(e->health < 1) { 
         e->alive = false; 
-        score += 10;
-        curEnemies--;
-        e->OnDeath(e);
+        g->score += 10;
+        g->curEnemies--;
+        METRIC_ADD(enemiesKilled, 1);
+        g->FreeEnemySlots[g->freeEnemyCount++] = e - g->Enemies;
+        RemoveEnemyFromGroup(g, e);
+        switch(e->type) {
+        #define X(TYPE, ATTACK, DEATH) case TYPE: DEATH(g, e); break;
+        ENEMY_ARCHETYPES(X)
+        #undef X
+        }
     }
-    lastTarget = e;
-    lastCalled = state.unpausedTime;
+    g->lastHitEnemy = e;
+    g->lastHitTime = g->unpausedTime;
     //puts(TextFormat("Enemy damaged by %d", dmg));
 }
 
-void DamageEnemiesRadius(Vector3 center, float radius, int dmg) {
+void DamageEnemiesRadius(Game* g, Vector3 center, float radius, int dmg) {
     for(int i = 0; i < MAX_ENEMIES; i++) {
-        if(Enemies[i].alive && 
-        Vector3Distance(center, (Vector3){Enemies[i].position.x, 1, Enemies[i].position.y}) < radius) {
-            DamageEnemy(&Enemies[i], dmg);
+        if(g->Enemies[i].alive && 
+        Vector3Distance(center, (Vector3){GetEnemyPosition(&g->Enemies[i]).x, 1, GetEnemyPosition(&g->Enemies[i]).y}) < radius) {
+            DamageEnemy(g, &g->Enemies[i], dmg);
         }
     }
 }
 
-void DamagePlayer(uint dmg) {
-    playerHealth -= dmg;
-    PlaySoundRPitch(playerHit);
-    if(playerHealth < 0) {
-        state.UpdateFunc = &UpdateGameOver;
-        state.DrawFunc = &DrawGameOver;
+void DamagePlayer(Game* g, Player* p, uint dmg) {
+    p->health -= dmg;
+    if(IsLocalPlayer(g, p)) {
+        PlaySoundRPitch(g, playerHit);
+    }
+    if(p->health < 0) {
+        p->alive = false;
+        if(!GetNearestPlayer(g, p->position, NULL)) {
+            g->outcome = MO_GameOver;
+        }
     }
 }
 
-void OnShootLaser(void) {
-    PlaySoundRPitch(revShoot);
-    Ray laserRay = {
-        .direction = Vector3Normalize(Vector3Subtract(cam.target, cam.position)),
-        .position = cam.position,
-    };
+//a little ahead of and below the eye, where the weapon sprite sits
+void QueueMuzzleFlash(Game* g, const Player* p) {
+    Ray aim = GetPlayerAimRay(p);
+    Vector3 muzzle = Vector3Add(aim.position, Vector3Scale(aim.direction, 0.8f));
+    muzzle.y -= 0.15f;
+    QueueEffect(g, EK_MuzzleFlash, muzzle, aim.direction);
+}
+
+void OnShootLaser(Game* g, Player* p) {
+    PlaySoundFromPlayer(g, revShoot, p);
+    QueueMuzzleFlash(g, p);
+    Ray laserRay = GetPlayerAimRay(p);
+    float reach = GetHitscanReach(g, laserRay);
     for(uint i = 0; i < MAX_ENEMIES; i++) {
-        if(!Enemies[i].alive) { continue; }
-        RayCollision colInfo = GetRayCollisionSphere(laserRay, (Vector3){Enemies[i].position.x, 1, Enemies[i].position.y}, 0.75f);
+        if(!g->Enemies[i].alive) { continue; }
+        //goes through every enemy up to the first prop
+        if(Vector2Distance(p->position, GetEnemyPosition(&g->Enemies[i])) > reach) { continue; }
+        RayCollision colInfo = GetRayCollisionSphere(laserRay, (Vector3){GetEnemyPosition(&g->Enemies[i]).x, 1, GetEnemyPosition(&g->Enemies[i]).y}, 0.75f);
         if(colInfo.hit) { 
-            DamageEnemy(&Enemies[i], Weapons[selectedWeapon].damage); 
+            DamageEnemy(g, &g->Enemies[i], p->weapons[p->selectedWeapon].damage); 
         }
     }
-    debugRays[0] = laserRay;
+    g->debugRays[0] = laserRay;
 }
 
-void OnShootLauncher(void) {
-    SpawnProjectile(playerPos.x, playerPos.y, 
-        Vector3Normalize(Vector3Subtract(cam.target, cam.position)), Weapons[selectedWeapon].damage, 13);
+void OnShootLauncher(Game* g, Player* p) {
+    QueueMuzzleFlash(g, p);
+    SpawnProjectile(g, p->position.x, p->position.y, 
+        GetPlayerAimRay(p).direction, p->weapons[p->selectedWeapon].damage, 13);
 }
 
-void OnShootShotgun(void) {
-    PlaySoundRPitch(sgunShoot);
-    Ray shotRay = {
-        .direction = Vector3Normalize(Vector3Subtract(cam.target, cam.position)),
-        .position = cam.position,
-    };
+void OnShootShotgun(Game* g, Player* p) {
+    PlaySoundFromPlayer(g, sgunShoot, p);
+    QueueMuzzleFlash(g, p);
+    Ray shotRay = GetPlayerAimRay(p);
     Vector3 origDir = shotRay.direction;
     Vector3 spread = Vector3Perpendicular(shotRay.direction);
     for(int j = 0; j < 8; j++) {
         Enemy* target = NULL;
+        float reach = GetHitscanReach(g, shotRay);
         int i = 0;
         while (i < MAX_ENEMIES)
         {
-            if(!Enemies[i].alive) { ++i; continue; }
-            RayCollision colInfo = GetRayCollisionSphere(shotRay, (Vector3){Enemies[i].position.x, 1, Enemies[i].position.y}, 0.75f);
+            if(!g->Enemies[i].alive || Vector2Distance(p->position, GetEnemyPosition(&g->Enemies[i])) > reach) { ++i; continue; }
+            RayCollision colInfo = GetRayCollisionSphere(shotRay, (Vector3){GetEnemyPosition(&g->Enemies[i]).x, 1, GetEnemyPosition(&g->Enemies[i]).y}, 0.75f);
             if(colInfo.hit) { 
-                target = &Enemies[i];
+                target = &g->Enemies[i];
                 break;
             }
             ++i;
@@ -443,48 +1491,73 @@ void OnShootShotgun(void) {
         if(target) {
             while (i < MAX_ENEMIES)
             {
-                if(!Enemies[i].alive) { ++i; continue; }
-                RayCollision colInfo = GetRayCollisionSphere(shotRay, (Vector3){Enemies[i].position.x, 1, Enemies[i].position.y}, 1);
+                if(!g->Enemies[i].alive || Vector2Distance(p->position, GetEnemyPosition(&g->Enemies[i])) > reach) { ++i; continue; }
+                RayCollision colInfo = GetRayCollisionSphere(shotRay, (Vector3){GetEnemyPosition(&g->Enemies[i]).x, 1, GetEnemyPosition(&g->Enemies[i]).y}, 1);
                 if(colInfo.hit) { 
-                    if(Vector2Distance(playerPos, target->position) < Vector2Distance(playerPos, Enemies[i].position)) { ++i; continue; }
-                    target = &Enemies[i];
+                    if(Vector2Distance(p->position, GetEnemyPosition(target)) < Vector2Distance(p->position, GetEnemyPosition(&g->Enemies[i]))) { ++i; continue; }
+                    target = &g->Enemies[i];
                 }
                 ++i;
             }
-            DamageEnemy(target, Weapons[selectedWeapon].damage);
+            DamageEnemy(g, target, p->weapons[p->selectedWeapon].damage);
         }
-        debugRays[j] = shotRay;
-        shotRay.direction = Vector3Add(Vector3Scale(spread, ((float)GetRandomValue(1, 10)/100.0f)),origDir);
-        shotRay.direction = Vector3RotateByAxisAngle(shotRay.direction, origDir, (float)GetRandomValue(0, 360)*DEG2RAD);
+        g->debugRays[j] = shotRay;
+        shotRay.direction = Vector3Add(Vector3Scale(spread, ((float)GetGameRandom(g, 1, 10)/100.0f)),origDir);
+        shotRay.direction = Vector3RotateByAxisAngle(shotRay.direction, origDir, (float)GetGameRandom(g, 0, 360)*DEG2RAD);
     }
 }
 
-void OnAttackAmogus(void) {
-    DamagePlayer(3);
+void OnAttackAmogus(Game* g, Player* p) {
+    DamagePlayer(g, p, 3);
+}
+
+void OnDeathAmogus(Game* g, Enemy* e) {
+    if(!GetGameRandom(g, 0, 4)) {
+        Vector2 at = GetEnemyPosition(e);
+        SpawnRandomItem(g, GetGameRandom(g, 0, 2), at.x, at.y);
+    }
+    //SpawnAmmo(g, WT_Pistol, 10, e->position.x, e->position.y);
 }
 
-void OnDeathAmogus(Enemy* e) {
-    if(!GetRandomValue(0, 4)) {
-        SpawnRandomItem(GetRandomValue(0, 2), e->position.x, e->position.y);
+//sounds are only queued here, they reach the speakers with the render snapshot of this tick
+//the pitch is rolled either way so a match plays out the same with or without anyone listening
+void QueueSound(Game* g, Sound sound, float pitch, float volume) {
+    if(g->localPlayer < 0) { return; }
+    if(g->soundQueueCount >= MAX_SOUND_EVENTS) {
+        METRIC_ADD(soundEventsDropped, 1);
+        return;
     }
-    //SpawnAmmo(WT_Pistol, 10, e->position.x, e->position.y);
+    METRIC_ADD(soundEvents, 1);
+    g->soundQueue[g->soundQueueCount++] = (SoundEvent){sound, pitch, volume};
 }
 
-void PlaySoundRPitch(Sound sound) {
-    float pitch = (float)GetRandomValue(90, 110) / 100.0f;
-    SetSoundPitch(sound, pitch);
-    SetSoundVolume(sound, 0.5f);
-    PlaySoundMulti(sound);
+//same as sounds, only where the listener can see it and handed over with the tick's render snapshot
+void QueueEffect(Game* g, int kind, Vector3 position, Vector3 direction) {
+    if(g->localPlayer < 0 || g->effectQueueCount >= MAX_EFFECT_EVENTS) { return; }
+    g->effectQueue[g->effectQueueCount++] = (EffectEvent){kind, position, direction};
 }
 
-void PlaySoundRPitchDirectional(Sound sound, Vector2 source) {
-    float pitch = (float)GetRandomValue(90, 110) / 100.0f;
-    SetSoundPitch(sound, pitch);
-    SetSoundVolume(sound, Clamp(1.0f - Vector2Distance(playerPos, source)/50.0f, 0.0f, 1.0f));
-    PlaySoundMulti(sound);
+void PlaySoundRPitch(Game* g, Sound sound) {
+    float pitch = (float)GetGameRandom(g, 90, 110) / 100.0f;
+    QueueSound(g, sound, pitch, 0.5f);
 }
 
-int GetFreeId(void* start, int max, size_t elSize) {
+void PlaySoundRPitchDirectional(Game* g, Sound sound, Vector2 source) {
+    float pitch = (float)GetGameRandom(g, 90, 110) / 100.0f;
+    if(g->localPlayer < 0) { return; }
+    QueueSound(g, sound, pitch, Clamp(1.0f - Vector2Distance(g->Players[g->localPlayer].position, source)/50.0f, 0.0f, 1.0f));
+}
+
+void PlaySoundFromPlayer(Game* g, Sound sound, const Player* p) {
+    if(IsLocalPlayer(g, p)) {
+        PlaySoundRPitch(g, sound);
+    }
+    else {
+        PlaySoundRPitchDirectional(g, sound, p->position);
+    }
+}
+
+int GetFreeId(const void* start, int max, size_t elSize) {
     const unsigned char* p = start;
     for(int i = 0; i < max; i++) {
         if(!*(bool*)p) { return i; }
@@ -493,63 +1566,173 @@ int GetFreeId(void* start, int max, size_t elSize) {
     return -1;
 }
 
-inline static int GetFreeEnemyId(void) {
-    return GetFreeId(Enemies, MAX_ENEMIES, sizeof(Enemy));
+inline static int GetFreePropId(const Game* g) {
+    return GetFreeId(g->Props, MAX_PROPS, sizeof(Prop));
+}
+
+inline static int GetFreeProjectileId(const Game* g) {
+    return GetFreeId(g->Projectiles, MAX_PROJECTILES, sizeof(Projectile));
+}
+
+inline static int GetFreeItemId(const Game* g) {
+    return GetFreeId(g->Items, MAX_ITEMS, sizeof(Item));
+}
+#pragma region Memory
+void* ArenaAlloc(Arena* a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if(a->size - a->used < size) { return NULL; }
+    void* p = a->base + a->used;
+    a->used += size;
+    if(a->used > a->highWater) { a->highWater = a->used; }
+    return p;
+}
+
+void ArenaReset(Arena* a) {
+    a->used = 0;
+}
+
+//per-frame string, valid until the end of the frame
+const char* FrameFormat(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    char* text = len < 0 ? NULL : ArenaAlloc(&frameArena, len + 1);
+    if(!text) { return ""; }
+    va_start(args, format);
+    vsnprintf(text, len + 1, format, args);
+    va_end(args);
+    return text;
 }
 
-inline static int GetFreePropId(void) {
-    return GetFreeId(Props, MAX_PROPS, sizeof(Prop));
+void* AllocItemData(Game* g, Item* i, uint size) {
+    i->data = ArenaAlloc(&g->waveArenas[g->waveArena], size);
+    i->dataSize = i->data ? size : 0;
+    if(!i->data) { i->active = false; }
+    return i->data;
 }
 
-inline static int GetFreeProjectileId(void) {
-    return GetFreeId(Projectiles, MAX_PROJECTILES, sizeof(Projectile));
+//items outlive the wave that dropped them, so their payloads move into the other arena before it is reused
+void SwapWaveArena(Game* g) {
+    Arena* next = &g->waveArenas[!g->waveArena];
+    ArenaReset(next);
+    for(int i = 0; i < MAX_ITEMS; i++) {
+        Item* it = &g->Items[i];
+        if(!it->active || !it->data) { continue; }
+        void* d = ArenaAlloc(next, it->dataSize);
+        if(d) { memcpy(d, it->data, it->dataSize); }
+        it->data = d;
+        it->active = d != NULL;
+    }
+    g->waveArena = !g->waveArena;
+}
+
+void ReportArenas(const Game* g) {
+    printf("Frame arena high water: %zu/%d bytes\n", frameArena.highWater, FRAME_ARENA_SIZE);
+    printf("Wave arena high water: %zu/%d bytes\n",
+        MAX(g->waveArenas[0].highWater, g->waveArenas[1].highWater), WAVE_ARENA_SIZE);
+}
+#pragma endregion
+//props and items share the 64px atlas layout, fixed so a headless server needs no textures
+Rectangle GetAtlasRect(int id) {
+    float xx, yy;
+    yy = (id / ATLAS_COLUMNS);
+    xx = id - yy * ATLAS_COLUMNS;
+    return (Rectangle) {
+        .height = 64,
+        .width = 64,
+        .y = yy * 64,
+        .x = xx * 64,
+    };
 }
 
-inline static int GetFreeItemId(void) {
-    return GetFreeId(Items, MAX_ITEMS, sizeof(Item));
+int GetAtlasId(Rectangle rect) {
+    return (int)(rect.y / 64) * ATLAS_COLUMNS + (int)(rect.x / 64);
 }
 //added bad id checks
 #pragma region Spawn
-void SpawnEnemy(int type, float x, float y) {
-    int id = GetFreeEnemyId();
-    if(id < 0) { return; }
-    Enemy* e = &Enemies[id];
+void AddEnemyToGroup(Game* g, Enemy* e) {
+    EnemyGroup* group = &g->EnemyGroups[e->type][e->state];
+    e->group = group->count;
+    group->ids[group->count++] = e - g->Enemies;
+}
+
+//swap-remove, the group's last enemy takes the freed index
+void RemoveEnemyFromGroup(Game* g, Enemy* e) {
+    EnemyGroup* group = &g->EnemyGroups[e->type][e->state];
+    int last = group->ids[--group->count];
+    group->ids[e->group] = last;
+    g->Enemies[last].group = e->group;
+}
+
+void SetEnemyState(Game* g, Enemy* e, int state) {
+    RemoveEnemyFromGroup(g, e);
+    e->state = state;
+    AddEnemyToGroup(g, e);
+}
+
+//dead enemy slots are kept on a stack so spawning never scans the pool, live ones are grouped by archetype and state
+void RebuildEnemyLists(Game* g) {
+    g->freeEnemyCount = 0;
+    memset(g->EnemyGroups, 0, sizeof(g->EnemyGroups));
+    for(int i = MAX_ENEMIES - 1; i >= 0; i--) {
+        if(!g->Enemies[i].alive) { g->FreeEnemySlots[g->freeEnemyCount++] = i; }
+    }
+    for(int i = 0; i < MAX_ENEMIES; i++) {
+        if(g->Enemies[i].alive) { AddEnemyToGroup(g, &g->Enemies[i]); }
+    }
+}
+
+void SpawnEnemy(Game* g, int type, float x, float y) {
+    if(g->freeEnemyCount < 1) {
+        METRIC_ADD(dropped[MP_Enemies], 1);
+        return;
+    }
+    METRIC_ADD(spawned[MP_Enemies], 1);
+    int id = g->FreeEnemySlots[--g->freeEnemyCount];
+    Enemy* e = &g->Enemies[id];
     e->alive = true;
-    e->position = (Vector2) {x, y};
+    e->type = type;
+    e->spawnTimer = SIM_SECONDS(SPAWN_IN_TIME);
+    SetEnemyPosition(e, (Vector2){x, y});
     e->spriteRect = (Rectangle) {0, 0 + type * 120 * 2, 120, 120};
-    e->curFrame = 0;
-    e->frameTimer = 0;
     e->state = ES_Wander;
+    e->lod = EL_Full;
+    e->seesTarget = false;
+    e->lastUpdate = g->enemyClock;
     switch (type)
     {
     case ET_Amogus:
         e->frames = 3;
-        e->frameTime = 0.4f;
-        e->health = 100 + GetRandomValue(10, 50);
+        e->frameTicks = ANIM_TICKS(0.4f);
+        e->health = 100 + GetGameRandom(g, 10, 50);
         e->attackRange = 1.0f;
         e->detectRange = 20.0f;
         e->speed = 5;
-        e->OnAttack = &OnAttackAmogus;
-        e->OnDeath = &OnDeathAmogus;
         break;
     
     default:
         e->frames = 3;
-        e->frameTime = 0.4f;
-        e->health = 100 + GetRandomValue(10, 50);
+        e->frameTicks = ANIM_TICKS(0.4f);
+        e->health = 100 + GetGameRandom(g, 10, 50);
         e->attackRange = 1.0f;
         e->detectRange = 20.0f;
         e->speed = 5;
-        e->OnAttack = &OnAttackAmogus;
-        e->OnDeath = &OnDeathAmogus;
         break;
     }
+    //one frame left once it has risen, the first wander cycle ends a frame after that
+    SetEnemyFrame(e, GetAnimTick(g) + ANIM_TICKS(SPAWN_IN_TIME), 0);
+    AddEnemyToGroup(g, e);
 }
 
-void SpawnProjectile(float x, float y, Vector3 velocity, int dmg, uint spd) {
-    int id = GetFreeProjectileId();
-    if(id < 0 ) { return; }
-    Projectile* b = &Projectiles[id];
+void SpawnProjectile(Game* g, float x, float y, Vector3 velocity, int dmg, uint spd) {
+    int id = GetFreeProjectileId(g);
+    if(id < 0) {
+        METRIC_ADD(dropped[MP_Projectiles], 1);
+        return;
+    }
+    METRIC_ADD(spawned[MP_Projectiles], 1);
+    Projectile* b = &g->Projectiles[id];
     b->active = true;
     b->velocity = velocity;
     b->speed = spd;
@@ -557,124 +1740,415 @@ void SpawnProjectile(float x, float y, Vector3 velocity, int dmg, uint spd) {
     b->damage = dmg;
 }
 
-void SpawnProp(int id, float x, float y) {
-    int jd = GetFreePropId();
-    if(jd < 0) { return; }
-    Prop* p = &Props[jd];
+void SpawnProp(Game* g, int id, float x, float y) {
+    int jd = GetFreePropId(g);
+    if(jd < 0) {
+        METRIC_ADD(dropped[MP_Props], 1);
+        return;
+    }
+    METRIC_ADD(spawned[MP_Props], 1);
+    Prop* p = &g->Props[jd];
     p->active = true;
     p->position = (Vector3) {x, 1, y};
-    float xx, yy;
-    yy = (id / (texProps.width / 64));
-    xx = id - yy * (texProps.width / 64);
-    p->spriteRect = (Rectangle) {
-        .height = 64,
-        .width = 64,
-        .y = yy * 64,
-        .x = xx * 64,
-    };
+    p->spriteRect = GetAtlasRect(id);
 }
 
-Item* SpawnItem(int id, float x, float y) {
-    int jd = GetFreeItemId();
-    if(jd < 0) { return NULL; }
-    Item* i = &Items[jd];
+Item* SpawnItem(Game* g, int id, float x, float y) {
+    int jd = GetFreeItemId(g);
+    if(jd < 0) {
+        METRIC_ADD(dropped[MP_Items], 1);
+        return NULL;
+    }
+    METRIC_ADD(spawned[MP_Items], 1);
+    Item* i = &g->Items[jd];
     i->active = true;
     i->position = (Vector3) {x, 1, y};
-    float xx, yy;
-    yy = (id / (texItems.width / 64));
-    xx = id - yy * (texItems.width / 64);
-    i->spriteRect = (Rectangle) {
-        .height = 64,
-        .width = 64,
-        .y = yy * 64,
-        .x = xx * 64,
-    };
+    i->spriteRect = GetAtlasRect(id);
     return i;
 }
 
-void SpawnAmmo(int weapon, int amount, float x, float y) {
-    Item* i = SpawnItem(AMO_OFFSET + weapon, x, y);
+void SpawnAmmo(Game* g, int weapon, int amount, float x, float y) {
+    Item* i = SpawnItem(g, AMO_OFFSET + weapon, x, y);
     if(!i) { return; }
-    int* d = (int*)malloc(sizeof(int)*2);
+    int* d = AllocItemData(g, i, sizeof(int)*2);
+    if(!d) { return; }
     d[0] = weapon;
     d[1] = amount;
-    i->data = d;
     i->OnPickUp = &OnPickUpAmmo;
 }
 
-void SpawnWeapon(int weapon, float x, float y) {
-    Item* i = SpawnItem(WEP_OFFSET + weapon, x, y);
+void SpawnWeapon(Game* g, int weapon, float x, float y) {
+    Item* i = SpawnItem(g, WEP_OFFSET + weapon, x, y);
     if(!i) { return; }
-    int* d = (int*)malloc(sizeof(int));
+    int* d = AllocItemData(g, i, sizeof(int));
+    if(!d) { return; }
     d[0] = weapon;
-    i->data = d;
     i->OnPickUp = &OnPickUpWeapon;
 }
 
-void SpawnMedkit(int hp, float x, float y) {
-    Item* i = SpawnItem(MKT_OFFSET, x, y);
+void SpawnMedkit(Game* g, int hp, float x, float y) {
+    Item* i = SpawnItem(g, MKT_OFFSET, x, y);
     if(!i) { return; }
-    int* d = (int*)malloc(sizeof(int));
+    int* d = AllocItemData(g, i, sizeof(int));
+    if(!d) { return; }
     d[0] = hp;
-    i->data = d;
     i->OnPickUp = &OnPickUpMedkit;
 }
 
-void SpawnMaxHP(int hp, float x, float y) {
-    Item* i = SpawnItem(MHP_OFFSET, x, y);
+void SpawnMaxHP(Game* g, int hp, float x, float y) {
+    Item* i = SpawnItem(g, MHP_OFFSET, x, y);
     if(!i) { return; }
-    int* d = (int*)malloc(sizeof(int));
+    int* d = AllocItemData(g, i, sizeof(int));
+    if(!d) { return; }
     d[0] = hp;
-    i->data = d;
     i->OnPickUp = &OnPickUpMaxHP;
 }
 
-void SpawnAmmoBag(int weapon, int amount, float x, float y) {
-    Item* i = SpawnItem(BAG_OFFSET, x, y);
+void SpawnAmmoBag(Game* g, int weapon, int amount, float x, float y) {
+    Item* i = SpawnItem(g, BAG_OFFSET, x, y);
     if(!i) { return; }
-    int* d = (int*)malloc(sizeof(int)*2);
+    int* d = AllocItemData(g, i, sizeof(int)*2);
+    if(!d) { return; }
     d[0] = weapon;
     d[1] = amount;
-    i->data = d;
     i->OnPickUp = &OnPickUpAmmoBag;
 }
 
-void SpawnRandomItem(int mod, float x, float y) {
-    int luck = GetRandomValue(0, 2);
+void BeginSpawnQueue(Game* g, int wave, int enemies) {
+    SpawnQueue* q = &g->spawnQueue;
+    q->wave = wave;
+    q->enemies = enemies > MAX_ENEMIES ? 0 : enemies;
+    q->total = q->enemies ? q->enemies + GetGameRandom(g, 3, 7) : 0;
+    q->count = 0;
+    q->next = 0;
+    q->credit = 0;
+    q->draining = false;
+}
+
+void PrepareSpawns(Game* g, int budget) {
+    SpawnQueue* q = &g->spawnQueue;
+    for(; q->count < q->total && budget > 0; q->count++, budget--) {
+        SpawnRequest* r = &q->requests[q->count];
+        if(q->count < q->enemies) {
+            *r = (SpawnRequest){
+                .kind = SK_Enemy,
+                .type = GetGameRandom(g, 0, MIN(q->wave, ET_LAST_ENTRY-1)),
+                .position = {GetGameRandom(g, -SPAWN_EXTENT, SPAWN_EXTENT), GetGameRandom(g, -SPAWN_EXTENT, SPAWN_EXTENT)},
+            };
+        }
+        else {
+            *r = (SpawnRequest){
+                .kind = SK_Ammo,
+                .type = Clamp(GetGameRandom(g, -3,WT_LAST_ENTRY-1), 0, WT_LAST_ENTRY-1),
+                .amount = GetGameRandom(g, 15, 30),
+                .position = {GetGameRandom(g, -WALK_EXTENT, WALK_EXTENT), GetGameRandom(g, -WALK_EXTENT, WALK_EXTENT)},
+            };
+        }
+    }
+}
+
+//while a wave plays the next one is prepared in the background, once it starts it is spawned over SPAWN_WINDOW
+void UpdateSpawns(Game* g) {
+    SpawnQueue* q = &g->spawnQueue;
+    if(!q->draining) {
+        //same sizing the wave transition in UpdateSimulation will apply
+        if(q->wave != g->curWave + 1) { BeginSpawnQueue(g, g->curWave + 1, g->curMaxEnemies + g->curWave * 10); }
+        PrepareSpawns(g, SPAWN_PREPARE_PER_TICK);
+        return;
+    }
+    q->credit += q->total * g->deltaTime / SPAWN_WINDOW;
+    int budget = Clamp((int)q->credit, 1, SPAWN_MAX_PER_TICK);
+    q->credit -= budget;
+    for(; q->next < q->count && budget > 0; q->next++, budget--) {
+        const SpawnRequest* r = &q->requests[q->next];
+        if(r->kind == SK_Enemy) {
+            SpawnEnemy(g, r->type, r->position.x, r->position.y);
+        }
+        else {
+            SpawnAmmo(g, r->type, r->amount, r->position.x, r->position.y);
+        }
+    }
+    if(q->next >= q->count) {
+        q->draining = false;
+    }
+}
+
+void SpawnRandomItem(Game* g, int mod, float x, float y) {
+    int luck = GetGameRandom(g, 0, 2);
     switch (luck + mod)
     {
     case 0:
-        SpawnAmmo(GetRandomValue(0, WT_LAST_ENTRY-1), GetRandomValue(10, 40), x, y);
+        SpawnAmmo(g, GetGameRandom(g, 0, WT_LAST_ENTRY-1), GetGameRandom(g, 10, 40), x, y);
         break;
     case 1:
-        SpawnMedkit(GetRandomValue(25, 40), x, y);
+        SpawnMedkit(g, GetGameRandom(g, 25, 40), x, y);
         break;
     case 2:
-        SpawnAmmoBag(GetRandomValue(0, WT_LAST_ENTRY-1), GetRandomValue(10, 40), x, y);
+        SpawnAmmoBag(g, GetGameRandom(g, 0, WT_LAST_ENTRY-1), GetGameRandom(g, 10, 40), x, y);
         break;
     case 3:
-        SpawnMaxHP(GetRandomValue(25, 40), x, y);
+        SpawnMaxHP(g, GetGameRandom(g, 25, 40), x, y);
         break;
     case 4:
-        SpawnWeapon(GetRandomValue(0, WT_LAST_ENTRY-1), x, y);
+        SpawnWeapon(g, GetGameRandom(g, 0, WT_LAST_ENTRY-1), x, y);
         break;
     default:
-        SpawnAmmo(GetRandomValue(0, WT_LAST_ENTRY-1), GetRandomValue(10, 40), x, y);
+        SpawnAmmo(g, GetGameRandom(g, 0, WT_LAST_ENTRY-1), GetGameRandom(g, 10, 40), x, y);
         break;
     }
 }
 #pragma endregion
+//payload memory comes back when the wave arena is recycled
 void DeleteItem(Item* item) {
     item->active = false;
-    free(item->data);
+    item->data = NULL;
 }
 
-void DeleteItems(void) {
+void DeleteItems(Game* g) {
     for(int i = 0; i < MAX_ITEMS; i++) {
-        if(!Items[i].active) { continue; }
-        DeleteItem(&Items[i]);
+        if(!g->Items[i].active) { continue; }
+        DeleteItem(&g->Items[i]);
+    }
+}
+#pragma region PropChunks
+static const PropChunk emptyPropChunk;
+
+static inline uint HashPropChunk(int cx, int cy) {
+    return ((uint)cx * 73856093u ^ (uint)cy * 19349663u) % PROP_CHUNK_TABLE;
+}
+
+//the grids of chunk cx, cy, NULL when no prop reaches into it
+const PropChunk* FindPropChunk(const Game* g, int cx, int cy) {
+    for(uint h = HashPropChunk(cx, cy);; h = (h + 1) % PROP_CHUNK_TABLE) {
+        int i = g->propChunkTable[h];
+        if(i == 0) { return NULL; }
+        if(g->propChunks[i - 1].cx == cx && g->propChunks[i - 1].cy == cy) { return &g->propChunks[i - 1]; }
+    }
+}
+
+//finds or adds chunk cx, cy with empty grids, NULL once MAX_PROP_CHUNKS are taken
+PropChunk* AddPropChunk(Game* g, int cx, int cy) {
+    uint h = HashPropChunk(cx, cy);
+    for(; g->propChunkTable[h] != 0; h = (h + 1) % PROP_CHUNK_TABLE) {
+        PropChunk* c = &g->propChunks[g->propChunkTable[h] - 1];
+        if(c->cx == cx && c->cy == cy) { return c; }
+    }
+    if(g->propChunkCount == MAX_PROP_CHUNKS) {
+        TraceLog(LOG_WARNING, "Props reach more than MAX_PROP_CHUNKS (%d) chunks, chunk %d, %d has no sight or collision", MAX_PROP_CHUNKS, cx, cy);
+        return NULL;
+    }
+    PropChunk* c = &g->propChunks[g->propChunkCount++];
+    memset(c, 0, sizeof(*c));
+    c->cx = cx;
+    c->cy = cy;
+    g->propChunkTable[h] = g->propChunkCount;
+    return c;
+}
+
+static inline const PropChunk* GetPropChunk(const Game* g, PropChunkCursor* at, int cx, int cy) {
+    if(cx != at->cx || cy != at->cy) { *at = (PropChunkCursor){cx, cy, FindPropChunk(g, cx, cy)}; }
+    return at->chunk;
+}
+#pragma endregion
+#pragma region Sight
+static inline int GetOccupancyCell(float v) {
+    return (int)floorf((v + MAP_SIZE / 2) * OCCUPANCY_CELLS_PER_UNIT);
+}
+
+//a step that stays in the cursor's chunk is one bounds check, chunks without props read as emptyPropChunk
+static inline bool IsCellOccupied(const Game* g, OccupancyCursor* at, int x, int y) {
+    uint lx = (uint)x - (uint)at->x0, ly = (uint)y - (uint)at->y0;
+    if(lx >= CHUNK_OCCUPANCY || ly >= CHUNK_OCCUPANCY) {
+        if((unsigned)x >= OCCUPANCY_CELLS || (unsigned)y >= OCCUPANCY_CELLS) { return false; }
+        const PropChunk* c = FindPropChunk(g, (uint)x / CHUNK_OCCUPANCY, (uint)y / CHUNK_OCCUPANCY);
+        lx = (uint)x % CHUNK_OCCUPANCY;
+        ly = (uint)y % CHUNK_OCCUPANCY;
+        *at = (OccupancyCursor){x - lx, y - ly, c ? c : &emptyPropChunk};
+    }
+    return at->chunk->occupancy[ly][lx >> 6] >> (lx & 63) & 1;
+}
+
+//marks every cell a prop's footprint touches, props never move so this only runs once the world is spawned
+//it starts the prop chunks over, so it runs before BuildCollision
+void BuildOccupancy(Game* g) {
+    g->propChunkCount = 0;
+    memset(g->propChunkTable, 0, sizeof(g->propChunkTable));
+    for(int i = 0; i < MAX_PROPS; i++) {
+        const Prop* p = &g->Props[i];
+        if(!p->active) { continue; }
+        int x0 = MAX(0, GetOccupancyCell(p->position.x - PROP_RADIUS));
+        int y0 = MAX(0, GetOccupancyCell(p->position.z - PROP_RADIUS));
+        //the far edge is exclusive, a footprint ending right on a cell border doesn't spill into the next one
+        int x1 = MIN(OCCUPANCY_CELLS - 1, (int)ceilf((p->position.x + PROP_RADIUS + MAP_SIZE / 2) * OCCUPANCY_CELLS_PER_UNIT) - 1);
+        int y1 = MIN(OCCUPANCY_CELLS - 1, (int)ceilf((p->position.z + PROP_RADIUS + MAP_SIZE / 2) * OCCUPANCY_CELLS_PER_UNIT) - 1);
+        for(int y = y0; y <= y1; y++) {
+            for(int x = x0; x <= x1; x++) {
+                PropChunk* c = AddPropChunk(g, x / CHUNK_OCCUPANCY, y / CHUNK_OCCUPANCY);
+                if(!c) { continue; }
+                int lx = x % CHUNK_OCCUPANCY;
+                c->occupancy[y % CHUNK_OCCUPANCY][lx >> 6] |= 1ull << (lx & 63);
+            }
+        }
+    }
+}
+
+//walks the cells the segment crosses in order (Amanatides & Woo) and returns the fraction of it that is clear, 1 when nothing is in the way
+//the cells holding either end never block, whoever stands there is already inside them
+float TraceOccupancy(const Game* g, Vector2 from, Vector2 to) {
+    float ox = (from.x + MAP_SIZE / 2) * OCCUPANCY_CELLS_PER_UNIT;
+    float oy = (from.y + MAP_SIZE / 2) * OCCUPANCY_CELLS_PER_UNIT;
+    float dx = (to.x - from.x) * OCCUPANCY_CELLS_PER_UNIT;
+    float dy = (to.y - from.y) * OCCUPANCY_CELLS_PER_UNIT;
+    int cx = (int)floorf(ox), cy = (int)floorf(oy);
+    const int ex = (int)floorf(ox + dx), ey = (int)floorf(oy + dy);
+    const int stepX = dx > 0 ? 1 : -1, stepY = dy > 0 ? 1 : -1;
+    //how far along the segment the next x and y cell borders are, and how far apart they follow each other
+    const float deltaX = dx != 0 ? fabsf(1.0f / dx) : INFINITY;
+    const float deltaY = dy != 0 ? fabsf(1.0f / dy) : INFINITY;
+    float nextX = dx != 0 ? (dx > 0 ? cx + 1 - ox : ox - cx) * deltaX : INFINITY;
+    float nextY = dy != 0 ? (dy > 0 ? cy + 1 - oy : oy - cy) * deltaY : INFINITY;
+    //starts on the empty chunk just outside the map's corner
+    OccupancyCursor at = {-CHUNK_OCCUPANCY, -CHUNK_OCCUPANCY, &emptyPropChunk};
+    for(;;) {
+        float t;
+        if(nextX < nextY) {
+            t = nextX;
+            nextX += deltaX;
+            cx += stepX;
+        }
+        else {
+            t = nextY;
+            nextY += deltaY;
+            cy += stepY;
+        }
+        if(t >= 1.0f || (cx == ex && cy == ey)) { return 1.0f; }
+        if(IsCellOccupied(g, &at, cx, cy)) { return t; }
+    }
+}
+
+bool HasLineOfSight(const Game* g, Vector2 from, Vector2 to) {
+    return TraceOccupancy(g, from, to) >= 1.0f;
+}
+
+//distance on the ground to the first prop along the ray, props count as full height
+float GetHitscanReach(const Game* g, Ray ray) {
+    Vector2 flat = {ray.direction.x, ray.direction.z};
+    float len = Vector2Length(flat);
+    if(len < 0.0001f) { return HITSCAN_RANGE; }
+    Vector2 from = {ray.position.x, ray.position.z};
+    Vector2 to = Vector2Add(from, Vector2Scale(flat, HITSCAN_RANGE / len));
+    return TraceOccupancy(g, from, to) * HITSCAN_RANGE;
+}
+#pragma endregion
+#pragma region Collision
+static inline int GetCollisionCell(float v) {
+    return Clamp(floorf((v + MAP_SIZE / 2) / COLLISION_CELL), 0, COLLISION_CELLS - 1);
+}
+
+//the chunk a prop's centre sorts into and its cell in there
+static PropChunk* GetColliderCell(Game* g, const Prop* p, int* cell) {
+    int x = GetCollisionCell(p->position.x), y = GetCollisionCell(p->position.z);
+    *cell = y % CHUNK_COLLISION * CHUNK_COLLISION + x % CHUNK_COLLISION;
+    return AddPropChunk(g, x / CHUNK_COLLISION, y / CHUNK_COLLISION);
+}
+
+//counting sort of the prop centres by chunk and cell, props never move so this only runs once the world is spawned
+void BuildCollision(Game* g) {
+    const int cells = CHUNK_COLLISION * CHUNK_COLLISION;
+    for(int k = 0; k < g->propChunkCount; k++) {
+        memset(g->propChunks[k].collisionStart, 0, sizeof(g->propChunks[k].collisionStart));
+    }
+    for(int i = 0; i < MAX_PROPS; i++) {
+        if(!g->Props[i].active) { continue; }
+        int cell;
+        PropChunk* c = GetColliderCell(g, &g->Props[i], &cell);
+        if(c) { c->collisionStart[cell + 1]++; }
+    }
+    //the chunks share colliders, each one's cells follow on from the chunk before
+    int total = 0;
+    for(int k = 0; k < g->propChunkCount; k++) {
+        int* start = g->propChunks[k].collisionStart;
+        start[0] = total;
+        for(int c = 0; c < cells; c++) { start[c + 1] += start[c]; }
+        total = start[cells];
+    }
+    //filling a cell moves its start up to the next cell's, so afterwards they're shifted back down by one
+    for(int i = 0; i < MAX_PROPS; i++) {
+        if(!g->Props[i].active) { continue; }
+        int cell;
+        PropChunk* c = GetColliderCell(g, &g->Props[i], &cell);
+        if(c) { g->colliders[c->collisionStart[cell]++] = (Vector2){g->Props[i].position.x, g->Props[i].position.z}; }
+    }
+    total = 0;
+    for(int k = 0; k < g->propChunkCount; k++) {
+        int* start = g->propChunks[k].collisionStart;
+        for(int c = cells; c > 0; c--) { start[c] = start[c - 1]; }
+        start[0] = total;
+        total = start[cells];
+    }
+}
+
+//earliest fraction of delta at which a circle moving from pos touches a prop, false when the whole move is clear
+//a circle already overlapping a prop may move out of it or along it, but not further in
+bool SweepCircle(const Game* g, Vector2 pos, Vector2 delta, float radius, float* hitTime, Vector2* hitNormal) {
+    const float reach = radius + PROP_RADIUS;
+    const float a = Vector2DotProduct(delta, delta);
+    //colliders are sorted by their centre, so the cells searched are grown by whatever can reach into the move
+    int x0 = GetCollisionCell(fminf(pos.x, pos.x + delta.x) - reach), x1 = GetCollisionCell(fmaxf(pos.x, pos.x + delta.x) + reach);
+    int y0 = GetCollisionCell(fminf(pos.y, pos.y + delta.y) - reach), y1 = GetCollisionCell(fmaxf(pos.y, pos.y + delta.y) + reach);
+    bool hit = false;
+    float best = 1.0f;
+    PropChunkCursor at = {-1, -1, NULL};
+    for(int y = y0; y <= y1; y++) {
+        for(int x = x0; x <= x1;) {
+            //the part of a row inside one chunk is one run of the sorted colliders
+            const int cx = x / CHUNK_COLLISION, last = MIN(x1, cx * CHUNK_COLLISION + CHUNK_COLLISION - 1);
+            const PropChunk* chunk = GetPropChunk(g, &at, cx, y / CHUNK_COLLISION);
+            const int row = y % CHUNK_COLLISION * CHUNK_COLLISION - cx * CHUNK_COLLISION;
+            const int first = chunk ? chunk->collisionStart[row + x] : 0, end = chunk ? chunk->collisionStart[row + last + 1] : 0;
+            x = last + 1;
+            for(int i = first; i < end; i++) {
+                Vector2 m = Vector2Subtract(pos, g->colliders[i]);
+                float b = Vector2DotProduct(m, delta);
+                //heading away or along, nothing in the way, the slack keeps a slide from catching on the prop it just left
+                if(b >= -1e-6f) { continue; }
+                float c = Vector2DotProduct(m, m) - reach * reach;
+                float t;
+                if(c <= 0) {
+                    t = 0;
+                }
+                else {
+                    float disc = b * b - a * c;
+                    if(disc < 0) { continue; }
+                    t = (-b - sqrtf(disc)) / a;
+                }
+                if(t > best || (hit && t == best)) { continue; }
+                best = t;
+                hit = true;
+                Vector2 n = Vector2Add(m, Vector2Scale(delta, t));
+                *hitNormal = Vector2LengthSqr(n) > 0 ? Vector2Normalize(n) : Vector2Normalize(Vector2Negate(delta));
+            }
+        }
     }
+    *hitTime = best;
+    return hit;
 }
+
+//moves a circle by delta, stopping where it meets a prop and sliding along it with what is left of the move
+Vector2 MoveCircle(const Game* g, Vector2 from, Vector2 delta, float radius) {
+    Vector2 pos = from;
+    for(int i = 0; i < COLLISION_SLIDES; i++) {
+        if(Vector2LengthSqr(delta) < 1e-10f) { return pos; }
+        float t;
+        Vector2 normal;
+        if(!SweepCircle(g, pos, delta, radius, &t, &normal)) { return Vector2Add(pos, delta); }
+        pos = Vector2Add(pos, Vector2Scale(delta, t));
+        Vector2 rest = Vector2Scale(delta, 1.0f - t);
+        delta = Vector2Subtract(rest, Vector2Scale(normal, Vector2DotProduct(rest, normal)));
+    }
+    return pos;
+}
+#pragma endregion
 #pragma region Assets
 void LoadAssets(void) {
     texEnemies = LoadTexture("assets/textures/enemies.png");
@@ -687,12 +2161,12 @@ void LoadAssets(void) {
     texWeapons = LoadTexture("assets/textures/weapons.png");
     texProps = LoadTexture("assets/textures/props.png");
     texGround = LoadTexture("assets/textures/ground.png");
+    //kept on the cpu to bake the chunk tiles from
+    groundImage = LoadImage("assets/textures/ground.png");
+    ImageFormat(&groundImage, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
     texItems = LoadTexture("assets/textures/items.png");
+    texParticle = LoadTexture("assets/textures/light0.png");
     GenTextureMipmaps(&texGround);
-    lightingTexture = LoadRenderTexture(MAP_SIZE*4, MAP_SIZE*4);
-    texLight = LoadTexture("assets/textures/light0.png");
-    SetTextureFilter(texLight, TEXTURE_FILTER_BILINEAR);
-    combinedTexture = LoadRenderTexture(MAP_SIZE*4, MAP_SIZE*4);
     mdSkybox = LoadModelFromMesh(GenMeshCube(1,1,1));
     Image img = LoadImage("assets/textures/skyboxx.png");
     mdSkybox.materials[0].maps[MATERIAL_MAP_CUBEMAP].texture = LoadTextureCubemap(img, CUBEMAP_LAYOUT_AUTO_DETECT);
@@ -700,8 +2174,28 @@ void LoadAssets(void) {
     mdSkybox.materials[0].shader = LoadShader("assets/shaders/skybox.vs", "assets/shaders/skybox.fs");
     SetShaderValue(mdSkybox.materials[0].shader, GetShaderLocation(mdSkybox.materials[0].shader, "environmentMap"), (int[1]){ MATERIAL_MAP_CUBEMAP }, SHADER_UNIFORM_INT);
     lightShader = LoadShader("assets/shaders/prop.vs", "assets/shaders/prop.fs");
-    lightmapULoc = GetShaderLocation(lightShader, "texLightmap");
-    SetShaderValueTexture(lightShader, lightmapULoc, lightingTexture.texture);
+    lightOriginULoc = GetShaderLocation(lightShader, "lightOrigin");
+    lightCountULoc = GetShaderLocation(lightShader, "lightCount");
+    lightPositionsULoc = GetShaderLocation(lightShader, "lightPositions");
+    lightColorsULoc = GetShaderLocation(lightShader, "lightColors");
+    animTickULoc = GetShaderLocation(lightShader, "animTick");
+    //only enemies animate, their frames are 120 texels apart along a row
+    SetShaderValue(lightShader, GetShaderLocation(lightShader, "frameWidth"),
+        (float[1]){120.0f / texEnemies.width}, SHADER_UNIFORM_FLOAT);
+    Color ambient = GetColor(LIGHT_AMBIENT);
+    SetShaderValue(lightShader, GetShaderLocation(lightShader, "ambient"),
+        (float[3]){ambient.r/255.0f, ambient.g/255.0f, ambient.b/255.0f}, SHADER_UNIFORM_VEC3);
+    sharpenShader = LoadShader(0, "assets/shaders/sharpen.fs");
+    sharpenUvMaxULoc = GetShaderLocation(sharpenShader, "uvMax");
+    sharpenAmountULoc = GetShaderLocation(sharpenShader, "sharpness");
+    //the 3D pass renders into its lower left corner at renderScale
+    canvas = LoadRenderTexture(GetScreenWidth(), GetScreenHeight());
+    SetTextureFilter(canvas.texture, TEXTURE_FILTER_BILINEAR);
+    SetTextureWrap(canvas.texture, TEXTURE_WRAP_CLAMP);
+    SetShaderValue(sharpenShader, GetShaderLocation(sharpenShader, "texelSize"),
+        (float[2]){1.0f / canvas.texture.width, 1.0f / canvas.texture.height}, SHADER_UNIFORM_VEC2);
+    hudBatch = rlLoadRenderBatch(1, HUD_BATCH_QUADS);
+    LoadGpuTimer();
     for(int i = 0; i < 3; i++) {
         lvl[i] = LoadMusicStream(TextFormat("assets/sfx/music/lvl%d.mp3", i+1));
     }
@@ -718,55 +2212,359 @@ void UnloadAssets(void) {
     UnloadTexture(texWeapons);
     UnloadTexture(texProps);
     UnloadTexture(texGround);
+    UnloadImage(groundImage);
+    for(int i = 0; i < MAX_RESIDENT_CHUNKS; i++) {
+        if(groundTiles[i].texture.id) { UnloadTexture(groundTiles[i].texture); }
+    }
+    memset(groundTiles, 0, sizeof(groundTiles));
     UnloadTexture(texItems);
-    UnloadRenderTexture(lightingTexture);
-    UnloadTexture(texLight);
-    UnloadRenderTexture(combinedTexture);
+    UnloadTexture(texParticle);
     UnloadModel(mdSkybox);
     UnloadShader(lightShader);
+    UnloadShader(sharpenShader);
+    UnloadRenderTexture(canvas);
+    rlUnloadRenderBatch(hudBatch);
+    UnloadGpuTimer();
     for(int i = 0; i < 3; i++) {
         UnloadMusicStream(lvl[i]);
     }
 }
 #pragma endregion
+#pragma region Particles
+//the particle rng stays off the match's so effects never change how a match plays out
+float GetParticleRandom(void) {
+    particleRng ^= particleRng << 13;
+    particleRng ^= particleRng >> 17;
+    particleRng ^= particleRng << 5;
+    return (particleRng >> 8) * (1.0f / 16777216.0f);
+}
+
+void RemoveParticle(ParticleSystem* ps, int i) {
+    int last = --ps->count;
+    ps->perPriority[ps->priority[i]]--;
+    ps->px[i] = ps->px[last]; ps->py[i] = ps->py[last]; ps->pz[i] = ps->pz[last];
+    ps->vx[i] = ps->vx[last]; ps->vy[i] = ps->vy[last]; ps->vz[i] = ps->vz[last];
+    ps->gravity[i] = ps->gravity[last];
+    ps->life[i] = ps->life[last];
+    ps->invLifetime[i] = ps->invLifetime[last];
+    ps->size[i] = ps->size[last];
+    ps->color[i] = ps->color[last];
+    ps->priority[i] = ps->priority[last];
+}
+
+//frees up to wanted slots by dropping particles of lower priority, lowest first, returns how many are free
+int MakeParticleRoom(ParticleSystem* ps, int wanted, int priority) {
+    int room = MAX(0, ps->budget - ps->count);
+    for(int p = 0; p < priority && room < wanted; p++) {
+        for(int i = ps->count - 1; i >= 0 && room < wanted && ps->perPriority[p]; i--) {
+            if(ps->priority[i] != p) { continue; }
+            RemoveParticle(ps, i);
+            room++;
+            particleStats.culled++;
+        }
+    }
+    return MIN(room, wanted);
+}
+
+void EmitEffect(ParticleSystem* ps, const EffectEvent* ev) {
+    const EffectStyle* st = &EffectStyles[ev->kind];
+    int n = MakeParticleRoom(ps, st->count, st->priority);
+    particleStats.dropped += st->count - n;
+    Vector3 dir = Vector3Normalize(ev->direction);
+    for(int k = 0; k < n; k++) {
+        Vector3 scatter = {GetParticleRandom() * 2 - 1, GetParticleRandom() * 2 - 1, GetParticleRandom() * 2 - 1};
+        Vector3 v = Vector3Normalize(Vector3Add(Vector3Scale(dir, 1.0f - st->spread), Vector3Scale(scatter, st->spread)));
+        float speed = st->speed * (0.5f + GetParticleRandom() * 0.5f);
+        float lifetime = st->lifetime * (0.7f + GetParticleRandom() * 0.6f);
+        int i = ps->count++;
+        ps->px[i] = ev->position.x; ps->py[i] = ev->position.y; ps->pz[i] = ev->position.z;
+        ps->vx[i] = v.x * speed; ps->vy[i] = v.y * speed; ps->vz[i] = v.z * speed;
+        ps->gravity[i] = st->gravity * PARTICLE_GRAVITY;
+        ps->life[i] = 1.0f;
+        ps->invLifetime[i] = 1.0f / lifetime;
+        ps->size[i] = st->size * (0.75f + GetParticleRandom() * 0.5f);
+        ps->color[i] = st->color;
+        ps->priority[i] = st->priority;
+        ps->perPriority[st->priority]++;
+    }
+    particleStats.emitted += n;
+}
+
+//plain loops over the arrays, nothing here branches per particle except the ground clamp
+void IntegrateParticles(ParticleSystem* ps, float dt) {
+    const int n = ps->count;
+    float* restrict px = ps->px; float* restrict py = ps->py; float* restrict pz = ps->pz;
+    float* restrict vx = ps->vx; float* restrict vy = ps->vy; float* restrict vz = ps->vz;
+    const float* restrict gravity = ps->gravity;
+    float* restrict life = ps->life;
+    const float* restrict invLifetime = ps->invLifetime;
+    for(int i = 0; i < n; i++) {
+        vy[i] -= gravity[i] * dt;
+        px[i] += vx[i] * dt;
+        py[i] += vy[i] * dt;
+        pz[i] += vz[i] * dt;
+        life[i] -= invLifetime[i] * dt;
+    }
+    for(int i = 0; i < n; i++) {
+        py[i] = fmaxf(py[i], 0.02f);
+    }
+    for(int i = ps->count - 1; i >= 0; i--) {
+        if(life[i] <= 0) { RemoveParticle(ps, i); }
+    }
+}
+
+//shrinks the live budget while particles take more than their share of the frame, and grows it back slowly
+void UpdateParticleBudget(ParticleSystem* ps) {
+    double cost = particleStats.updateTime + particleStats.drawTime;
+    particleStats.costAvg += (cost - particleStats.costAvg) * RENDER_SCALE_SMOOTHING;
+    double share = frameBudget * PARTICLE_COST_SHARE;
+    if(particleStats.costAvg > share && ps->count >= ps->budget / 2) {
+        ps->budget = MAX(PARTICLE_BUDGET_MIN, (int)(ps->budget * Clamp(share / particleStats.costAvg, 0.5f, 0.95f)));
+    }
+    else if(particleStats.costAvg < share * 0.5 && ps->budget < PARTICLE_BUDGET) {
+        ps->budget = MIN(PARTICLE_BUDGET, ps->budget + PARTICLE_BUDGET_MIN / 8);
+    }
+    //over the new budget, what's live just runs out
+}
+
+//main thread only, the effects of the snapshot just collected go off and everything live moves on by a frame
+void RunEffects(const RenderSnapshot* r) {
+    double start = GetTime();
+    particleStats.emitted = particleStats.culled = particleStats.dropped = 0;
+    for(int i = 0; i < r->effectCount; i++) {
+        EmitEffect(&particles, &r->effects[i]);
+    }
+    IntegrateParticles(&particles, GetFrameTime());
+    particleStats.updateTime = GetTime() - start;
+    UpdateParticleBudget(&particles);
+    atomic_store_explicit(&metrics.particles, particles.count, memory_order_relaxed);
+    atomic_store_explicit(&metrics.particleBudget, particles.budget, memory_order_relaxed);
+    METRIC_ADD(particlesCulled, particleStats.culled + particleStats.dropped);
+}
+
+//camera facing additive quads in one batch on the glow texture, after the scene so they only test against its depth
+void DrawParticles(void) {
+    if(!particles.count) { particleStats.drawTime = 0; return; }
+    double start = GetTime();
+    Matrix view = GetCameraMatrix(cam);
+    Vector3 right = {view.m0, view.m4, view.m8};
+    Vector3 up = {view.m1, view.m5, view.m9};
+    BeginBlendMode(BLEND_ADDITIVE);
+    rlDisableDepthMask();
+    rlSetTexture(texParticle.id);
+    for(int i = 0; i < particles.count; i++) {
+        //same texture and mode every time, so these all merge into one draw unless the batch fills up
+        rlCheckRenderBatchLimit(4);
+        rlBegin(RL_QUADS);
+        float s = particles.size[i] * (0.4f + 0.6f * particles.life[i]);
+        Vector3 p = {particles.px[i], particles.py[i], particles.pz[i]};
+        Vector3 rs = Vector3Scale(right, s), us = Vector3Scale(up, s);
+        Color c = particles.color[i];
+        rlColor4ub(c.r, c.g, c.b, (unsigned char)(c.a * Clamp(particles.life[i], 0, 1)));
+        rlTexCoord2f(0, 0); rlVertex3f(p.x - rs.x + us.x, p.y - rs.y + us.y, p.z - rs.z + us.z);
+        rlTexCoord2f(0, 1); rlVertex3f(p.x - rs.x - us.x, p.y - rs.y - us.y, p.z - rs.z - us.z);
+        rlTexCoord2f(1, 1); rlVertex3f(p.x + rs.x - us.x, p.y + rs.y - us.y, p.z + rs.z - us.z);
+        rlTexCoord2f(1, 0); rlVertex3f(p.x + rs.x + us.x, p.y + rs.y + us.y, p.z + rs.z + us.z);
+        rlEnd();
+    }
+    rlSetTexture(0);
+    //ending the blend mode flushes the batch, which has to happen before depth writes come back
+    EndBlendMode();
+    rlEnableDepthMask();
+    particleStats.drawTime = GetTime() - start;
+}
+#pragma endregion
 #pragma region Render
-Vector2 MapCoordToLightCoord(float x, float y) {
-    return (Vector2){(x + MAP_SIZE/2) * 4, (y + MAP_SIZE/2) * 4};
+//world position of a chunk's -x/-z corner
+Vector2 GetChunkOrigin(int cx, int cy) {
+    return (Vector2){cx * CHUNK_SIZE - MAP_SIZE/2, cy * CHUNK_SIZE - MAP_SIZE/2};
 }
 
-void RenderLightTexture(void) {
-    BeginTextureMode(lightingTexture); 
-    {
-        float scale = 5.3;
-        float colorscale = scale * 1.2;
-        DrawRectangle(0, 0, MAP_SIZE*4, MAP_SIZE*4, GetColor(0x01021aFF));
-        Vector2 plp = MapCoordToLightCoord(playerPos.x, playerPos.y);
-        DrawTextureEx(texLight, Vector2Subtract((Vector2){plp.x, plp.y} , (Vector2){16*20,16*20}), 0, 20, GetColor(0x22223222));
-        DrawTextureEx(texLight, Vector2Subtract((Vector2){plp.x, plp.y} , (Vector2){16*scale,16*scale}), 0, scale, GetColor(0x99999944));
-        for(int i = 0; i < MAX_PROJECTILES; i++) {
-            if(!Projectiles[i].active) { continue; }
-            Vector2 p = MapCoordToLightCoord(Projectiles[i].position.x, Projectiles[i].position.z);
-            float s = Clamp(0.0f + Projectiles[i].position.y/2.0f, 2.5f, 15.0f);
-            DrawTextureEx(texLight, Vector2Subtract(p, (Vector2){16.0f*s,16.0f*s}), 0, s, GetColor(0xAAAAAA77));
-        }
-        for(int i = 0; i < MAX_ITEMS; i++) {
-            if(!Items[i].active) { continue; }
-            Vector2 p = MapCoordToLightCoord(Items[i].position.x, Items[i].position.z);
-            DrawTextureEx(texLight, Vector2Subtract(p, (Vector2){16.0f*1.0f,16.0f*1.0f}), 0, 1, GetColor(0xAAAAAA77));
-        }
-        BeginBlendMode(BLEND_ADDITIVE);
-        DrawTextureEx(texLight, Vector2Subtract((Vector2){plp.x, plp.y} , (Vector2){16*colorscale,16*colorscale}), 0, colorscale, GetColor(0xAAAAAAAA) );
-        EndBlendMode();
-    }
-    EndTextureMode();
-    BeginTextureMode(combinedTexture); 
-    {
-        DrawTextureTiled(texGround, (Rectangle) {0, 0, 512, 512}, (Rectangle) {0, 0, MAP_SIZE*4, MAP_SIZE*4}, (Vector2) {0, 0}, 0, 1, WHITE);
-        BeginBlendMode(BLEND_MULTIPLIED);
-        DrawTextureQuad(lightingTexture.texture, (Vector2){1,-1}, (Vector2){0,0}, (Rectangle){0,0,MAP_SIZE*4,MAP_SIZE*4}, WHITE);
-        EndBlendMode();
+//picks the chunks within RESIDENT_RADIUS of the viewer nearest first, up to MAX_VISIBLE_CHUNKS of them within VIEW_RADIUS are visible
+void UpdateVisibleChunks(Vector2 viewer) {
+    int vx = (int)floorf((viewer.x + MAP_SIZE/2) / CHUNK_SIZE);
+    int vy = (int)floorf((viewer.y + MAP_SIZE/2) / CHUNK_SIZE);
+    viewOriginX = vx - VIEW_CHUNKS/2;
+    viewOriginY = vy - VIEW_CHUNKS/2;
+    memset(viewWindow, 0xFF, sizeof(viewWindow));
+    int candidates[VIEW_CHUNKS * VIEW_CHUNKS];
+    float distances[VIEW_CHUNKS * VIEW_CHUNKS];
+    int count = 0;
+    for(int i = 0; i < VIEW_CHUNKS * VIEW_CHUNKS; i++) {
+        int cx = viewOriginX + i % VIEW_CHUNKS;
+        int cy = viewOriginY + i / VIEW_CHUNKS;
+        if(cx < 0 || cy < 0 || cx >= WORLD_CHUNKS || cy >= WORLD_CHUNKS) { continue; }
+        Vector2 o = GetChunkOrigin(cx, cy);
+        Vector2 nearest = Vector2Clamp(viewer, o, (Vector2){o.x + CHUNK_SIZE, o.y + CHUNK_SIZE});
+        float d = Vector2Distance(viewer, nearest);
+        if(d > RESIDENT_RADIUS) { continue; }
+        int j = count++;
+        for(; j > 0 && distances[j-1] > d; j--) {
+            candidates[j] = candidates[j-1];
+            distances[j] = distances[j-1];
+        }
+        candidates[j] = i;
+        distances[j] = d;
+    }
+    residentChunkCount = count;
+    visibleChunkCount = 0;
+    for(int i = 0; i < count; i++) {
+        int w = candidates[i];
+        Chunks[i] = (Chunk){ .cx = viewOriginX + w % VIEW_CHUNKS, .cy = viewOriginY + w / VIEW_CHUNKS, .tile = -1 };
+        if(distances[i] <= VIEW_RADIUS && i < MAX_VISIBLE_CHUNKS) {
+            viewWindow[w] = i;
+            visibleChunkCount++;
+        }
+    }
+}
+
+//the ground texels under chunk cx, cy with a soft contact shadow under every prop reaching into it
+void BakeGroundTile(const RenderSnapshot* r, GroundTile* tile, int cx, int cy) {
+    const Color* ground = groundImage.data;
+    for(int y = 0; y < CHUNK_TEXELS; y++) {
+        const Color* row = &ground[(cy * CHUNK_TEXELS + y) % groundImage.height * groundImage.width];
+        for(int x = 0; x < CHUNK_TEXELS; x++) {
+            tileTexels[y * CHUNK_TEXELS + x] = row[(cx * CHUNK_TEXELS + x) % groundImage.width];
+        }
+    }
+    //in texels from the chunk's corner, texel rows run along z like the ground cube's uvs
+    const Vector2 o = GetChunkOrigin(cx, cy);
+    const float scale = (float)CHUNK_TEXELS / CHUNK_SIZE;
+    const float radius = PROP_SHADOW_RADIUS * scale;
+    for(int h = 0; h < r->spriteCount; h++) {
+        const RenderSprite* sp = &r->sprites[h];
+        if(sp->sheet != SS_Props) { continue; }
+        const float px = (sp->position.x - o.x) * scale, py = (sp->position.z - o.y) * scale;
+        const int x0 = MAX(0, (int)floorf(px - radius)), x1 = MIN(CHUNK_TEXELS - 1, (int)ceilf(px + radius));
+        const int y0 = MAX(0, (int)floorf(py - radius)), y1 = MIN(CHUNK_TEXELS - 1, (int)ceilf(py + radius));
+        for(int y = y0; y <= y1; y++) {
+            for(int x = x0; x <= x1; x++) {
+                float d = ((x + 0.5f - px) * (x + 0.5f - px) + (y + 0.5f - py) * (y + 0.5f - py)) / (radius * radius);
+                if(d >= 1.0f) { continue; }
+                float k = 1.0f - PROP_SHADOW_DEPTH * (1.0f - d) * (1.0f - d);
+                Color* t = &tileTexels[y * CHUNK_TEXELS + x];
+                *t = (Color){t->r * k, t->g * k, t->b * k, t->a};
+            }
+        }
+    }
+    if(tile->texture.id == 0) {
+        tile->texture = LoadTextureFromImage((Image){tileTexels, CHUNK_TEXELS, CHUNK_TEXELS, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8});
+        //neighbouring tiles are separate textures, clamping keeps their edges from bleeding into each other
+        SetTextureWrap(tile->texture, TEXTURE_WRAP_CLAMP);
+    }
+    else {
+        UpdateTexture(tile->texture, tileTexels);
+    }
+    GenTextureMipmaps(&tile->texture);
+    *tile = (GroundTile){cx, cy, true, groundFrame, tile->texture};
+}
+
+//hands the ring its tiles, the nearest chunks still without one are baked into slots no chunk of this frame holds
+void StreamGroundTiles(const RenderSnapshot* r) {
+    groundFrame++;
+    uint64_t props = 1469598103934665603ull;
+    for(int h = 0; h < r->spriteCount; h++) {
+        if(r->sprites[h].sheet != SS_Props) { continue; }
+        uint32_t u[2];
+        memcpy(&u[0], &r->sprites[h].position.x, sizeof(float));
+        memcpy(&u[1], &r->sprites[h].position.z, sizeof(float));
+        props = ((props ^ u[0]) * 1099511628211ull ^ u[1]) * 1099511628211ull;
+    }
+    if(props != groundProps) {
+        for(int t = 0; t < MAX_RESIDENT_CHUNKS; t++) { groundTiles[t].baked = false; }
+        groundProps = props;
+    }
+    //first every chunk claims the tile it already has, so a bake never takes one drawn this frame
+    for(int i = 0; i < residentChunkCount; i++) {
+        Chunk* c = &Chunks[i];
+        for(int t = 0; t < MAX_RESIDENT_CHUNKS; t++) {
+            GroundTile* tile = &groundTiles[t];
+            if(!tile->baked || tile->cx != c->cx || tile->cy != c->cy) { continue; }
+            tile->lastUsed = groundFrame;
+            c->tile = t;
+            break;
+        }
+    }
+    int bakes = 0;
+    for(int i = 0; i < residentChunkCount && bakes < TILE_BAKES_PER_FRAME; i++) {
+        Chunk* c = &Chunks[i];
+        if(c->tile >= 0) { continue; }
+        int slot = -1;
+        for(int t = 0; t < MAX_RESIDENT_CHUNKS; t++) {
+            const GroundTile* tile = &groundTiles[t];
+            if(tile->lastUsed == groundFrame) { continue; }
+            if(slot < 0 || !tile->baked || (groundTiles[slot].baked && tile->lastUsed < groundTiles[slot].lastUsed)) { slot = t; }
+            if(!tile->baked) { break; }
+        }
+        //the ring is bigger than the budget, the rest keep the plain ground
+        if(slot < 0) { break; }
+        BakeGroundTile(r, &groundTiles[slot], c->cx, c->cy);
+        c->tile = slot;
+        bakes++;
+    }
+}
+
+//visible index of the chunk under a world position, -1 when it is not streamed in
+int GetVisibleChunk(float x, float z) {
+    int cx = (int)floorf((x + MAP_SIZE/2) / CHUNK_SIZE) - viewOriginX;
+    int cy = (int)floorf((z + MAP_SIZE/2) / CHUNK_SIZE) - viewOriginY;
+    if(cx < 0 || cy < 0 || cx >= VIEW_CHUNKS || cy >= VIEW_CHUNKS) { return -1; }
+    int v = viewWindow[cy * VIEW_CHUNKS + cx];
+    return v == 0xFF ? -1 : v;
+}
+
+//gives every visible chunk the lights overlapping it, keeping the strongest LIGHTS_PER_CHUNK
+void AssignLights(const RenderSnapshot* r) {
+    Vector2 viewer = {cam.position.x, cam.position.z};
+    UpdateVisibleChunks(viewer);
+    frameLights = r->lights;
+    for(int v = 0; v < visibleChunkCount; v++) {
+        Chunk* c = &Chunks[v];
+        Vector2 o = GetChunkOrigin(c->cx, c->cy);
+        float weights[LIGHTS_PER_CHUNK];
+        for(int i = 0; i < r->lightCount; i++) {
+            const PointLight* l = &frameLights[i];
+            if(l->position.x + l->radius < o.x || l->position.x - l->radius > o.x + CHUNK_SIZE ||
+                l->position.y + l->radius < o.y || l->position.y - l->radius > o.y + CHUNK_SIZE) { continue; }
+            float w = (l->color.x + l->color.y + l->color.z) * l->radius;
+            int slot = c->lightCount;
+            if(slot == LIGHTS_PER_CHUNK) {
+                slot = 0;
+                for(int j = 1; j < LIGHTS_PER_CHUNK; j++) {
+                    if(weights[j] < weights[slot]) { slot = j; }
+                }
+                if(weights[slot] >= w) { continue; }
+            }
+            else {
+                c->lightCount++;
+            }
+            c->lights[slot] = i;
+            weights[slot] = w;
+        }
+    }
+}
+
+//uploads a chunk's lights relative to its origin, so the shader never sees large world coordinates
+void SetChunkLights(const Chunk* c) {
+    Vector2 o = c ? GetChunkOrigin(c->cx, c->cy) : Vector2Zero();
+    int count = c ? c->lightCount : 0;
+    float positions[LIGHTS_PER_CHUNK * 3];
+    float colors[LIGHTS_PER_CHUNK * 3];
+    for(int i = 0; i < count; i++) {
+        const PointLight* l = &frameLights[c->lights[i]];
+        positions[i*3 + 0] = l->position.x - o.x;
+        positions[i*3 + 1] = l->position.y - o.y;
+        positions[i*3 + 2] = l->radius;
+        colors[i*3 + 0] = l->color.x;
+        colors[i*3 + 1] = l->color.y;
+        colors[i*3 + 2] = l->color.z;
+    }
+    SetShaderValue(lightShader, lightOriginULoc, &o, SHADER_UNIFORM_VEC2);
+    SetShaderValue(lightShader, lightCountULoc, &count, SHADER_UNIFORM_INT);
+    if(count > 0) {
+        SetShaderValueV(lightShader, lightPositionsULoc, positions, SHADER_UNIFORM_VEC3, count);
+        SetShaderValueV(lightShader, lightColorsULoc, colors, SHADER_UNIFORM_VEC3, count);
     }
-    EndTextureMode();
 }
 
 void DrawSkybox(void) {
@@ -777,105 +2575,342 @@ void DrawSkybox(void) {
     rlEnableDepthMask();
 }
 
-void DrawEnemies(void) {
-    for(int i = 0; i < curMaxEnemies; i++) {
-        if(!Enemies[i].alive) { continue; }
-        DrawBillboardRec(cam, texEnemies, Enemies[i].spriteRect, 
-            (Vector3){Enemies[i].position.x, 1, Enemies[i].position.y}, 
-            (Vector2){1,1}, WHITE);
-        //DrawSphereWires((Vector3){Enemies[i].position.x, 1, Enemies[i]. position.y},0.75f,6,6,YELLOW);
+void DrawRenderSprite(const RenderSprite* sp) {
+    Texture2D sheet = sp->sheet == SS_Props ? texProps : sp->sheet == SS_Items ? texItems : texEnemies;
+    DrawBillboardRec(cam, sheet, sp->source, sp->position, (Vector2){sp->size, sp->size}, sp->anim);
+}
+
+//a chunk's streamed tile, or the plain ground texture until it has one
+void DrawChunkGround(const Chunk* c) {
+    Vector2 o = GetChunkOrigin(c->cx, c->cy);
+    Vector3 centre = {o.x + CHUNK_SIZE/2, 0, o.y + CHUNK_SIZE/2};
+    if(c->tile >= 0) {
+        DrawCubeTextureRec(groundTiles[c->tile].texture, (Rectangle){0, 0, CHUNK_TEXELS, CHUNK_TEXELS}, centre, CHUNK_SIZE, 0.1f, CHUNK_SIZE, WHITE);
+        return;
     }
+    //texGround repeats every 128 units, offsetting the source keeps the tiling seamless across chunks
+    Rectangle src = {(c->cx * CHUNK_TEXELS) % texGround.width, (c->cy * CHUNK_TEXELS) % texGround.height, CHUNK_TEXELS, CHUNK_TEXELS};
+    DrawCubeTextureRec(texGround, src, centre, CHUNK_SIZE, 0.1f, CHUNK_SIZE, WHITE);
 }
 
-void DrawProps(void) {
-    for(int i = 0; i < MAX_PROPS; i++) {
-        if(!Props[i].active) { continue; }
-        DrawBillboardRec(cam, texProps, Props[i].spriteRect,
-        Props[i].position, (Vector2){2,2}, WHITE);
+//buckets billboards by chunk, each bucket is drawn with that chunk's lights right after its ground tile
+void DrawLitScene(const RenderSnapshot* r) {
+    int* bucketOf = ArenaAlloc(&frameArena, BILLBOARD_COUNT * sizeof(int));
+    int* order = ArenaAlloc(&frameArena, BILLBOARD_COUNT * sizeof(int));
+    if(!bucketOf || !order) { return; }
+    //bucket 0 holds everything outside the visible chunks, lit by ambient only
+    const int buckets = visibleChunkCount + 1;
+    int start[MAX_VISIBLE_CHUNKS + 2] = {0};
+    int cursor[MAX_VISIBLE_CHUNKS + 1];
+    for(int h = 0; h < r->spriteCount; h++) {
+        const Vector3 pos = r->sprites[h].position;
+        bucketOf[h] = GetVisibleChunk(pos.x, pos.z) + 1;
+        start[bucketOf[h] + 1]++;
     }
+    for(int b = 0; b < buckets; b++) {
+        start[b + 1] += start[b];
+        cursor[b] = start[b];
+    }
+    for(int h = 0; h < r->spriteCount; h++) {
+        order[cursor[bucketOf[h]]++] = h;
+    }
+    BeginShaderMode(lightShader);
+    //exact in a float, prop.vs works modulo 65536 as well
+    float tick = r->animTick & 0xFFFF;
+    SetShaderValue(lightShader, animTickULoc, &tick, SHADER_UNIFORM_FLOAT);
+    for(int b = 0; b < buckets; b++) {
+        //lights are per batch, flush what the previous chunk queued
+        rlDrawRenderBatchActive();
+        const Chunk* c = b > 0 ? &Chunks[b - 1] : NULL;
+        SetChunkLights(c);
+        if(c) {
+            DrawChunkGround(c);
+        }
+        else {
+            //the rest of the ring is past VIEW_RADIUS and only gets ambient
+            for(int i = visibleChunkCount; i < residentChunkCount; i++) { DrawChunkGround(&Chunks[i]); }
+        }
+        for(int i = start[b]; i < start[b + 1]; i++) {
+            DrawRenderSprite(&r->sprites[order[i]]);
+        }
+    }
+    EndShaderMode();
 }
 
-void DrawItems(void) {
-    for(int i = 0; i < MAX_ITEMS; i++) {
-        if(!Items[i].active) { continue; }
-        DrawBillboardRec(cam, texItems, Items[i].spriteRect,
-        Items[i].position, (Vector2) {1,1}, WHITE);
+void DrawProjectiles(const RenderSnapshot* r) {
+    for(int i = 0; i < r->projectileCount; i++) {
+        DrawSphere(r->projectiles[i], 0.5f, BLUE);
+        //DrawSphereWires(r->projectiles[i], 0.5f, 5, 5, BLUE);
     }
 }
 
-void DrawProjectiles(void) {
-    for(int i = 0; i < MAX_PROJECTILES; i++) {
-        if(!Projectiles[i].active) { continue; }
-        Vector3 tmp = Vector3Add(Projectiles[i].position, Vector3Scale(Projectiles[i].velocity, Projectiles[i].speed));
-        Ray r;
-        r.position = Projectiles[i].position;
-        r.direction = Projectiles[i].velocity;
-        //DrawRay(r, RED);
-        DrawSphere(Projectiles[i].position, 0.5f, BLUE);
-        //DrawSphereWires(Projectiles[i].position, 0.5f, 5, 5, BLUE);
+void DrawPlayers(const RenderSnapshot* r) {
+    for(int i = 0; i < r->playerCount; i++) {
+        DrawCylinder((Vector3){r->players[i].x, 0.05f, r->players[i].y}, 0.35f, 0.35f, 1.6f, 8, SKYBLUE);
     }
 }
 
-void DrawScene(void) {
-    DrawCubeTexture(combinedTexture.texture, (Vector3){0, 0, 0}, MAP_SIZE, 0.1f, MAP_SIZE,WHITE);
-    SetShaderValueTexture(lightShader, lightmapULoc, lightingTexture.texture);
-    BeginShaderMode(lightShader);
-    DrawProps();
-    DrawItems();
-    DrawEnemies();
-    EndShaderMode();
-    DrawProjectiles();
+void DrawScene(const RenderSnapshot* r) {
+    AssignLights(r);
+    StreamGroundTiles(r);
+    DrawLitScene(r);
+    DrawProjectiles(r);
+    DrawPlayers(r);
 }
 
-void DrawWeapon(void) {
+void DrawWeapon(const RenderSnapshot* r) {
+    Rectangle src = r->weaponRect;
     DrawTexturePro(texWeapons, 
-        Weapons[selectedWeapon].spriteRect, 
-        (Rectangle){GetScreenWidth()/2 - Weapons[selectedWeapon].spriteRect.width*4 / 2, 
-            GetScreenHeight() - 500, Weapons[selectedWeapon].spriteRect.width*4, 500},
+        src, 
+        (Rectangle){GetScreenWidth()/2 - src.width*4 / 2, 
+            GetScreenHeight() - 500, src.width*4, 500},
         Vector2Zero(), 0, WHITE);
 }
 
-void DrawUI(void) {
+//the layout DrawText does for the default font, kept so it only runs when the text changes
+void LayoutHudText(HudText* t, int fontSize) {
+    const Font font = GetFontDefault();
+    const float scale = (float)fontSize / font.baseSize;
+    const float spacing = (float)fontSize / 10;
+    const float pad = font.glyphPadding;
+    float x = 0;
+    t->glyphCount = 0;
+    for(const char* c = t->text; *c; c++) {
+        int index = GetGlyphIndex(font, *c);
+        Rectangle rec = font.recs[index];
+        if(*c != ' ' && *c != '\t') {
+            t->glyphs[t->glyphCount++] = (HudGlyph){
+                .dest = {x + (font.glyphs[index].offsetX - pad) * scale, (font.glyphs[index].offsetY - pad) * scale,
+                    (rec.width + 2 * pad) * scale, (rec.height + 2 * pad) * scale},
+                .uv = {(rec.x - pad) / font.texture.width, (rec.y - pad) / font.texture.height,
+                    (rec.width + 2 * pad) / font.texture.width, (rec.height + 2 * pad) / font.texture.height},
+            };
+        }
+        x += (font.glyphs[index].advanceX ? font.glyphs[index].advanceX : rec.width) * scale + spacing;
+    }
+}
+
+//formats, measures and lays out only when the values behind the text change
+const HudText* UpdateHudText(HudText* t, const char* format, int a, int b, int fontSize) {
+    if(t->valid && t->values[0] == a && t->values[1] == b) { return t; }
+    snprintf(t->text, sizeof(t->text), format, a, b);
+    t->width = MeasureText(t->text, fontSize);
+    LayoutHudText(t, fontSize);
+    t->values[0] = a;
+    t->values[1] = b;
+    t->valid = true;
+    return t;
+}
+
+//straight from the cached quads, nothing is looked up or measured per character
+void DrawHudText(const HudText* t, int x, int y, Color color) {
+    rlCheckRenderBatchLimit(4 * t->glyphCount);
+    rlSetTexture(GetFontDefault().texture.id);
+    rlBegin(RL_QUADS);
+        rlColor4ub(color.r, color.g, color.b, color.a);
+        rlNormal3f(0.0f, 0.0f, 1.0f);
+        for(int i = 0; i < t->glyphCount; i++) {
+            const Rectangle d = t->glyphs[i].dest;
+            const Rectangle uv = t->glyphs[i].uv;
+            rlTexCoord2f(uv.x, uv.y);
+            rlVertex2f(x + d.x, y + d.y);
+            rlTexCoord2f(uv.x, uv.y + uv.height);
+            rlVertex2f(x + d.x, y + d.y + d.height);
+            rlTexCoord2f(uv.x + uv.width, uv.y + uv.height);
+            rlVertex2f(x + d.x + d.width, y + d.y + d.height);
+            rlTexCoord2f(uv.x + uv.width, uv.y);
+            rlVertex2f(x + d.x + d.width, y + d.y);
+        }
+    rlEnd();
+    rlSetTexture(0);
+}
+
+//everything here is quads on the default font texture (raylib's shapes texture), so it ends up in a single draw
+void DrawUI(const RenderSnapshot* r) {
+    double start = GetTime();
+    rlSetRenderBatchActive(&hudBatch);
     //DrawText(TextFormat("%f %f %f",cam.position.x,cam.position.y,cam.position.z), 220, 40, 20, GRAY);
-    DrawFPS(10, 10);
-    const char* text;
-    DrawText(TextFormat("Ammo: %d/%d", Weapons[selectedWeapon].ammo, Weapons[selectedWeapon].ammoCap), 10, GetScreenHeight()-20, 20, WHITE);
-    DrawText(TextFormat("Health: %d/%d", playerHealth, playerHealthMax), 10, GetScreenHeight()-40, 20, WHITE);
-    text = TextFormat("Enemies Remaining: %d", curEnemies);
-    DrawText(text, GetScreenWidth()-MeasureText(text,20) - 10, GetScreenHeight()-20, 20, WHITE);
-    text = TextFormat("Wave: %d", curWave + 1);
-    DrawText(text, GetScreenWidth()-MeasureText(text,20) - 10, GetScreenHeight()-40, 20, WHITE);
-    text = TextFormat("SCORE: %d", score);
-    DrawText(text, GetScreenWidth()/2-MeasureText(text,40)/2, 10, 40, WHITE);
-    DrawCircleLines(GetScreenWidth()/2, GetScreenHeight()/2, 10, LIME);
-    for(int i = 0; i < MAX_ENEMIES; i++) {
-        if(!Enemies[i].alive) { continue; }
-        Vector3 a = Vector3Normalize(Vector3Subtract((Vector3){cam.target.x, 1, cam.target.z}, cam.position));
-        Vector3 b = Vector3Normalize(Vector3Subtract((Vector3){Enemies[i].position.x, 1, Enemies[i].position.y}, cam.position));
-        Vector2 p = GetWorldToScreen((Vector3){Enemies[i].position.x, 1, Enemies[i].position.y}, cam);
-        DrawCircle(p.x, 60, 6, RAYWHITE);
-        if(Vector3Angle(a, b) * RAD2DEG < 90)
-            DrawCircle(p.x, 60, 5, RED);
-        else
-            DrawCircle(p.x, 60, 5, DARKBROWN);
+    const int width = GetScreenWidth();
+    const int height = GetScreenHeight();
+    const HudText* t;
+    int fps = GetFPS();
+    t = UpdateHudText(&hudFps, "%2i FPS", fps, 0, 20);
+    DrawHudText(t, 10, 10, fps < 15 ? RED : fps < 30 ? ORANGE : LIME);
+    if (debug) {
+        t = UpdateHudText(&hudStats, "HUD: %d us, %d draws", (int)(hudCpuTime * 1000000.0), hudDrawCalls, 20);
+        DrawHudText(t, 10, 35, LIME);
+        t = UpdateHudText(&hudMemory, "Arenas: frame %d KB, wave %d KB", (int)(frameArena.highWater / 1024), (int)(r->waveArenaHighWater / 1024), 20);
+        DrawHudText(t, 10, 60, LIME);
+        t = UpdateHudText(&hudChunks, "Chunks: %d visible, %d lights", visibleChunkCount, r->lightCount, 20);
+        DrawHudText(t, 10, 85, LIME);
+        t = UpdateHudText(&hudRender, "3D pass: %d%% scale, %d us gpu", (int)(renderScale * 100.0f + 0.5f), (int)((gpuTimerReady ? gpuFrameAvg : frameWorkAvg - frameCpuAvg) * 1000000.0), 20);
+        DrawHudText(t, 10, 110, LIME);
+        t = UpdateHudText(&hudParticles, "Particles: %d of %d", particles.count, particles.budget, 20);
+        DrawHudText(t, 10, 135, LIME);
+    }
+    if(localInput.overlayToggles & 1) {
+        int n = MIN(latencySampleCount, LATENCY_SAMPLES);
+        double sum = 0, worst = 0;
+        for(int i = 0; i < n; i++) {
+            sum += latencySamples[i];
+            worst = MAX(worst, latencySamples[i]);
+        }
+        t = UpdateHudText(&hudLatency, "Input to present: %d us avg, %d us max", n ? (int)(sum / n * 1000000.0) : 0, (int)(worst * 1000000.0), 20);
+        DrawHudText(t, 10, debug ? 160 : 35, LIME);
+    }
+    t = UpdateHudText(&hudAmmo, "Ammo: %d/%d", r->ammo, r->ammoCap, 20);
+    DrawHudText(t, 10, height-20, WHITE);
+    t = UpdateHudText(&hudHealth, "Health: %d/%d", r->health, r->healthMax, 20);
+    DrawHudText(t, 10, height-40, WHITE);
+    t = UpdateHudText(&hudEnemies, "Enemies Remaining: %d", r->enemies, 0, 20);
+    DrawHudText(t, width - t->width - 10, height-20, WHITE);
+    t = UpdateHudText(&hudWave, "Wave: %d", r->wave + 1, 0, 20);
+    DrawHudText(t, width - t->width - 10, height-40, WHITE);
+    t = UpdateHudText(&hudScore, "SCORE: %d", r->score, 0, 40);
+    DrawHudText(t, width/2 - t->width/2, 10, WHITE);
+    DrawRing((Vector2){width/2, height/2}, 9.5f, 10.5f, 0, 360, 24, LIME);
+    Vector3 a = Vector3Normalize(Vector3Subtract((Vector3){cam.target.x, 1, cam.target.z}, cam.position));
+    //same projection GetWorldToScreen builds, but once per frame instead of once per pip
+    Matrix viewProj = MatrixMultiply(GetCameraMatrix(cam), MatrixPerspective(cam.fovy*DEG2RAD, (double)width/height, 0.01, 1000.0));
+    for(int i = 0; i < r->spriteCount; i++) {
+        if(r->sprites[i].sheet != SS_Enemies) { continue; }
+        Vector3 pos = {r->sprites[i].position.x, 1, r->sprites[i].position.z};
+        Vector3 b = Vector3Normalize(Vector3Subtract(pos, cam.position));
+        Quaternion clip = QuaternionTransform((Quaternion){pos.x, pos.y, pos.z, 1}, viewProj);
+        float x = (clip.x / clip.w + 1.0f) / 2.0f * width;
+        DrawRectangle(x - 6, 54, 12, 12, RAYWHITE);
+        DrawRectangle(x - 5, 55, 10, 10, Vector3Angle(a, b) * RAD2DEG < 90 ? RED : DARKBROWN);
+    }
+    hudDrawCalls = hudBatch.drawCounter;
+    rlSetRenderBatchActive(NULL);
+    hudCpuTime = GetTime() - start;
+}
+
+//raylib's glad loads the query functions with the rest of GL 3.3, its header just isn't shipped
+#define GL_TIME_ELAPSED 0x88BF
+#define GL_QUERY_RESULT 0x8866
+#define GL_QUERY_RESULT_AVAILABLE 0x8867
+extern void (*glad_glGenQueries)(int n, unsigned int* ids);
+extern void (*glad_glDeleteQueries)(int n, const unsigned int* ids);
+extern void (*glad_glBeginQuery)(unsigned int target, unsigned int id);
+extern void (*glad_glEndQuery)(unsigned int target);
+extern void (*glad_glGetQueryObjectiv)(unsigned int id, unsigned int name, int* params);
+extern void (*glad_glGetQueryObjectui64v)(unsigned int id, unsigned int name, uint64_t* params);
+
+void LoadGpuTimer(void) {
+    gpuTimerReady = rlGetVersion() >= OPENGL_33 && rlGetVersion() != OPENGL_ES_20 && glad_glGenQueries && glad_glGetQueryObjectui64v;
+    if(gpuTimerReady) { glad_glGenQueries(GPU_TIMER_QUERIES, gpuQueries); }
+}
+
+void UnloadGpuTimer(void) {
+    if(gpuTimerReady) { glad_glDeleteQueries(GPU_TIMER_QUERIES, gpuQueries); }
+    gpuTimerReady = false;
+}
+
+//picks up whichever earlier frames have finished on the gpu, then times this one unless its query is still out
+void StartGpuTimer(void) {
+    if(!gpuTimerReady) { return; }
+    for(int i = 0; i < GPU_TIMER_QUERIES; i++) {
+        int available = 0;
+        if(gpuQueryPending[i]) { glad_glGetQueryObjectiv(gpuQueries[i], GL_QUERY_RESULT_AVAILABLE, &available); }
+        if(!available) { continue; }
+        uint64_t ns = 0;
+        glad_glGetQueryObjectui64v(gpuQueries[i], GL_QUERY_RESULT, &ns);
+        gpuFrameAvg += (ns * 1e-9 - gpuFrameAvg) * RENDER_SCALE_SMOOTHING;
+        gpuQueryPending[i] = false;
+    }
+    if(gpuQueryPending[gpuQueryNext]) { return; }
+    gpuQueryActive = gpuQueryNext;
+    gpuQueryNext = (gpuQueryNext + 1) % GPU_TIMER_QUERIES;
+    glad_glBeginQuery(GL_TIME_ELAPSED, gpuQueries[gpuQueryActive]);
+}
+
+//the batch is flushed first so what was queued this frame is inside the query, the swap is not
+void StopGpuTimer(void) {
+    if(gpuQueryActive < 0) { return; }
+    rlDrawRenderBatchActive();
+    glad_glEndQuery(GL_TIME_ELAPSED);
+    gpuQueryPending[gpuQueryActive] = true;
+    gpuQueryActive = -1;
+}
+
+//pixels go with the square of the scale, so a frame over budget jumps straight to the scale that should fit
+void UpdateRenderScale(void) {
+    frameWorkAvg += (frameWorkTime - frameWorkAvg) * RENDER_SCALE_SMOOTHING;
+    frameCpuAvg += (frameCpuTime - frameCpuAvg) * RENDER_SCALE_SMOOTHING;
+    if(renderScaleHold > 0) {
+        renderScaleHold--;
+        return;
+    }
+    double gpu;
+    if(gpuTimerReady) { gpu = gpuFrameAvg; }
+    //without a timer the gpu only shows up as the wait in EndDrawing, which vsync pads out to a full refresh
+    else if(frameRate == FRAME_RATE_VSYNC) { return; }
+    else { gpu = frameWorkAvg - frameCpuAvg; }
+    double gpuBudget = frameBudget - frameCpuAvg;
+    if(frameWorkAvg > frameBudget * 1.1 && gpuBudget > 0 && gpu > gpuBudget) {
+        //vsync rounds a missed frame up to two, so never trust a single estimate for more than a few steps
+        float lowest = MAX(RENDER_SCALE_MIN, renderScale - RENDER_SCALE_STEP * 4);
+        renderScale = Clamp(renderScale * sqrtf(gpuBudget / gpu), lowest, 1.0f);
+        renderScaleHold = RENDER_SCALE_HOLD_DOWN;
     }
+    else if(renderScale < 1.0f) {
+        //a measured gpu goes back up only while the next step's pixels still fit, the estimate while frames are on time
+        float grow = (renderScale + RENDER_SCALE_STEP) / renderScale;
+        if(gpuTimerReady ? gpu * grow * grow < gpuBudget * 0.9 : frameWorkAvg < frameBudget * 1.02) {
+            renderScale = Clamp(renderScale + RENDER_SCALE_STEP, RENDER_SCALE_MIN, 1.0f);
+            renderScaleHold = RENDER_SCALE_HOLD_UP;
+        }
+    }
+}
+
+//stretches the rendered corner of the canvas over the screen, sharpening harder the further it's scaled
+void DrawCanvas(int width, int height) {
+    Rectangle src = {0, 0, width, -height};
+    Rectangle dst = {0, 0, GetScreenWidth(), GetScreenHeight()};
+    if(width == canvas.texture.width && height == canvas.texture.height) {
+        DrawTexturePro(canvas.texture, src, dst, Vector2Zero(), 0, WHITE);
+        return;
+    }
+    float sharpness = Clamp((1.0f - renderScale) * 2.0f, 0, 1);
+    SetShaderValue(sharpenShader, sharpenUvMaxULoc,
+        (float[2]){(width - 0.5f) / canvas.texture.width, (height - 0.5f) / canvas.texture.height}, SHADER_UNIFORM_VEC2);
+    SetShaderValue(sharpenShader, sharpenAmountULoc, &sharpness, SHADER_UNIFORM_FLOAT);
+    BeginShaderMode(sharpenShader);
+        DrawTexturePro(canvas.texture, src, dst, Vector2Zero(), 0, WHITE);
+    EndShaderMode();
 }
 
 void Draw(void) {
+    const RenderSnapshot* r = &renderSnapshots[renderFront];
+    UpdateRenderScale();
+    const int width = MAX(1, (int)(canvas.texture.width * renderScale + 0.5f));
+    const int height = MAX(1, (int)(canvas.texture.height * renderScale + 0.5f));
     BeginDrawing();
-        ClearBackground(RAYWHITE);
-        RenderLightTexture();
-        BeginMode3D(cam);
-            DrawSkybox();
-            DrawScene();
-            if (debug) {
-                for(int i = 0; i<8; i++) {
-                    DrawRay(debugRays[i], RED);
-                }
-            } 
-        EndMode3D();
-        DrawWeapon();
-        DrawUI();
+        StartGpuTimer();
+        BeginTextureMode(canvas);
+            //the scale is the same on both axes, so the projection's aspect from the full canvas still holds
+            rlViewport(0, 0, width, height);
+            ClearBackground(RAYWHITE);
+            //aim from the freshest mouse motion, whatever else it carries goes with the next tick's input
+            LatchLocalInput();
+            UpdateViewCamera(r->viewPosition, r->viewBobbing, botPlayer ? r->viewRotation : localInput.rotation);
+            BeginMode3D(cam);
+                DrawSkybox();
+                DrawScene(r);
+                DrawParticles();
+                if (debug) {
+                    for(int i = 0; i<8; i++) {
+                        DrawRay(r->debugRays[i], RED);
+                    }
+                } 
+            EndMode3D();
+        EndTextureMode();
+        DrawCanvas(width, height);
+        DrawWeapon(r);
+        DrawUI(r);
+        StopGpuTimer();
+        frameCpuTime = GetTime() - frameStartTime;
     EndDrawing();
 }
 
@@ -883,7 +2918,7 @@ void DrawGameOver(void) {
     BeginDrawing();
         ClearBackground(MAROON);
         const char* text;
-        text = TextFormat("YOUR SCORE: %d", score);
+        text = FrameFormat("YOUR SCORE: %d", renderSnapshots[renderFront].score);
         DrawText(text, GetScreenWidth()/2-MeasureText(text,40)/2, GetScreenHeight()/2+50, 40, BLACK);
         text = "GAME OVER";
         DrawText(text, GetScreenWidth()/2-MeasureText(text,40)/2, GetScreenHeight()/2, 40, BLACK);
@@ -894,7 +2929,7 @@ void DrawWin(void) {
     BeginDrawing();
         ClearBackground(LIGHTGRAY);
         const char* text;
-        text = TextFormat("YOUR SCORE: %d", score);
+        text = FrameFormat("YOUR SCORE: %d", renderSnapshots[renderFront].score);
         DrawText(text, GetScreenWidth()/2-MeasureText(text,40)/2, GetScreenHeight()/2+50, 40, RAYWHITE);
         text = "YOU WON!";
         DrawText(text, GetScreenWidth()/2-MeasureText(text,40)/2, GetScreenHeight()/2, 40, RAYWHITE);
@@ -902,177 +2937,421 @@ void DrawWin(void) {
 }
 #pragma endregion
 #pragma region Update
-void UpdateWeapon(void) {
-    int key = GetKeyPressed();
-    if(key >= KEY_ONE && key <= KEY_ONE + WT_LAST_ENTRY - 1) {
-        if(Weapons[key - KEY_ONE].unlocked) {
-            selectedWeapon = key - KEY_ONE;
-        }
+//adds what the last input poll registered, must run exactly once after every poll or edges get lost or doubled
+//weaponSlot sticks until whoever consumes it resets it to -1
+PlayerInput PollLocalInput(PlayerInput in) {
+    Vector2 mouseDelta = GetMouseDelta();
+    in.rotation.y -= mouseDelta.x * mouseSensitivity.x;
+    if (in.rotation.y > 360)
+        in.rotation.y -= 360;
+    else if (in.rotation.y < 0)
+        in.rotation.y += 360;
+    in.rotation.x += mouseDelta.y * mouseSensitivity.y;
+    in.rotation.x = Clamp(in.rotation.x, -80, 80);
+    in.move = (Vector2){IsKeyDown(KEY_A) - IsKeyDown(KEY_D), IsKeyDown(KEY_W) - IsKeyDown(KEY_S)};
+    if(IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
+        in.fireCount++;
     }
-    Weapon *wep = &Weapons[selectedWeapon];
-    if(wep->curFrame) {
-        wep->frameTimer += state.deltaTime;
-        if(wep->frameTimer > wep->frameTime) {
-            wep->frameTimer = 0;
-            wep->curFrame--;
-            wep->spriteRect.x -= (wep->spriteRect.width);
+    for(int key = GetKeyPressed(); key; key = GetKeyPressed()) {
+        if(key >= KEY_ONE && key <= KEY_ONE + WT_LAST_ENTRY - 1) {
+            in.weaponSlot = key - KEY_ONE;
+        }
+        else if(key == KEY_F3) {
+            in.overlayToggles++;
         }
     }
-    else if(wep->ammo && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) { 
-        wep->curFrame = wep->frames - 1;
-        wep->spriteRect.x = (wep->frames - 1) * (wep->spriteRect.width);
-        wep->ammo--;
-        wep->OnShoot();
-    }
+    return in;
 }
 
-void UpdateView(void) {
-    //Camera rotation and bobbing
-    rotation.y -= mouseDelta.x * mouseSensitivity.x * state.deltaTime;
-    if (rotation.y > 360)
-        rotation.y -= 360;
-    else if (rotation.y < 0)
-        rotation.y += 360;
-    rotation.x += mouseDelta.y * mouseSensitivity.y * state.deltaTime;
-    rotation.x = Clamp(rotation.x, -80, 80);
-    Quaternion Q = QuaternionMultiply(
-        QuaternionFromAxisAngle((Vector3){0, 1, 0}, rotation.y * DEG2RAD),
-        QuaternionFromAxisAngle((Vector3){1, 0, 0}, rotation.x * DEG2RAD));
-    float camBobbing = sin(10 * state.unpausedTime) * Vector2Length(playerVel) * 0.01;
-    cam.position = (Vector3){playerPos.x, 1 + camBobbing, playerPos.y};
-    //Vector2 oldTarget = (Vector2){cam.target.x, cam.target.z};
-    cam.target = Vector3Add(
-        cam.position,
-        Vector3RotateByQuaternion((Vector3){0, 0, 1}, Q));
-    //cam.target = Vector3Lerp((Vector3){oldTarget.x, cam.target.y, oldTarget.y}, cam.target, state.deltaTime * 20);
-    //Player movement
-    Vector2 oldVel = playerVel;
-    playerVel = (Vector2){IsKeyDown(KEY_A) - IsKeyDown(KEY_D), IsKeyDown(KEY_W) - IsKeyDown(KEY_S)};
-    playerVel = Vector2Normalize(playerVel);
-    playerVel.x *= playerSpeed;
-    playerVel.y *= playerSpeed;
-    playerVel = Vector2Lerp(oldVel, playerVel, state.deltaTime * 20);
-    playerPos = Vector2Add(Vector2Rotate((Vector2){playerVel.x * state.deltaTime, playerVel.y * state.deltaTime}, -rotation.y * DEG2RAD), playerPos);
-    playerPos = Vector2Clamp(playerPos, (Vector2){-MAP_SIZE/2+28, -MAP_SIZE/2+28}, (Vector2){MAP_SIZE/2-28, MAP_SIZE/2-28});
+//polls again right before the input is needed instead of using what EndDrawing polled a frame ago
+void LatchLocalInput(void) {
+    PollInputEvents();
+    localInput = PollLocalInput(localInput);
+    inputLatchTime = GetTime();
 }
 
-void UpdateEnemy(Enemy* e) {
-    if(!e->alive) { return; }
-    //if(e->curFrame) {
-        e->frameTimer += state.deltaTime;
-        if(e->frameTimer > e->frameTime) {
-            e->frameTimer = 0;
-            e->curFrame--;
-            if(e->curFrame > -1)
-                e->spriteRect.x -= e->spriteRect.width;
-        }
-    //}
-    e->position = Vector2Clamp(Vector2Add(e->position, 
-        Vector2Scale(e->velocity, e->speed * state.deltaTime)), 
-        (Vector2){-MAP_SIZE/2+28, -MAP_SIZE/2+28}, (Vector2){MAP_SIZE/2-28, MAP_SIZE/2-28});
-    switch (e->state)
-    {
-    case ES_Wander:
-        if(e->curFrame < 0) {
-            if(GetRandomValue(0, 1)) { 
-                e->velocity = Vector2Normalize((Vector2){GetRandomValue(-1, 1), GetRandomValue(-1, 1)}); 
-            }
-            e->curFrame = e->frames - 1;
-            e->spriteRect.x = (e->frames - 1) * e->spriteRect.width;
-        }
-        if(Vector2Distance(playerPos, e->position) < e->detectRange) {
-            e->state = ES_Pursue;
-            e->curFrame = 0;
-        }
-        break;
-
-    case ES_Pursue:
-        e->velocity = Vector2Normalize(Vector2Subtract(playerPos, e->position));
-        if(e->curFrame < 0) {
-            e->curFrame = e->frames - 1;
-            e->spriteRect.x = (e->frames - 1) * e->spriteRect.width;
-        }
-        if(Vector2Distance(playerPos, e->position) < e->attackRange) {
-            e->state = ES_Attack;
-            e->OnAttack();
-            e->velocity = Vector2Zero();
-            e->curFrame = 0;
-            e->spriteRect.y += e->spriteRect.height;
-        }
-        break;
+//EndDrawing has returned, so the frame latched at inputLatchTime has been handed to the display
+void RecordPresent(void) {
+    double now = GetTime();
+    latencySamples[latencySampleCount++ % LATENCY_SAMPLES] = now - inputLatchTime;
+    frameWorkTime = now - frameStartTime;
+    presentInterval = presentTime ? now - presentTime : 0;
+    presentTime = now;
+}
 
-    case ES_Attack:
-        if(e->curFrame < 0) {
-            if(Vector2Distance(playerPos, e->position) >= e->attackRange) {
-                e->state = ES_Pursue;
-                e->curFrame = 0;
-                e->spriteRect.y -= e->spriteRect.height;
-                break;
-            }
-            e->curFrame = e->frames - 1;
-            e->spriteRect.x = (e->frames - 1) * e->spriteRect.width;
-            e->OnAttack();
-        }
-        break;
-    
-    default:
-        break;
+double GetWaveStatsPercentile(const WaveStats* w, double fraction) {
+    uint goal = (uint)ceil(w->frames * fraction);
+    uint seen = 0;
+    for(int i = 0; i < WAVE_STATS_BUCKETS; i++) {
+        seen += w->histogram[i];
+        if(seen >= goal) { return (i + 1) * WAVE_STATS_BUCKET_MS; }
     }
-    
+    return WAVE_STATS_BUCKETS * WAVE_STATS_BUCKET_MS;
 }
 
-void UpdateEnemies(void) {
-    for(int i = 0; i < MAX_ENEMIES; i++) {
-        if(!Enemies[i].alive) { continue; }
-        UpdateEnemy(Enemies + i);
+void ReportWaveStats(const WaveStats* w) {
+    if(!w->frames) { return; }
+    printf("wave %d: %u frames, %.2f ms avg, %.1f ms p50, %.1f ms p99, %.2f ms max, work %.2f ms avg, %.2f ms max\n",
+        w->wave + 1, w->frames, w->intervalSum * 1000.0 / w->frames,
+        GetWaveStatsPercentile(w, 0.5), GetWaveStatsPercentile(w, 0.99), w->intervalMax * 1000.0,
+        w->workSum * 1000.0 / w->frames, w->workMax * 1000.0);
+}
+
+//reported whenever the wave on screen changes and once more when the match ends
+void RecordWaveFrame(const RenderSnapshot* r) {
+    if(r->wave != waveStats.wave) {
+        ReportWaveStats(&waveStats);
+        waveStats = (WaveStats){ .wave = r->wave };
     }
+    if(presentInterval <= 0) { return; }
+    WaveStats* w = &waveStats;
+    int bucket = (int)(presentInterval * 1000.0 / WAVE_STATS_BUCKET_MS);
+    w->histogram[bucket < WAVE_STATS_BUCKETS ? bucket : WAVE_STATS_BUCKETS - 1]++;
+    w->frames++;
+    w->intervalSum += presentInterval;
+    w->intervalMax = fmax(w->intervalMax, presentInterval);
+    w->workSum += frameWorkTime;
+    w->workMax = fmax(w->workMax, frameWorkTime);
 }
 
-void UpdateItem(Item* i) {
-    if(!i->active) { return; }
-    i->position.y = 1.0 + sin(state.unpausedTime * 10.0) * 0.01;
-    if(Vector2Distance(playerPos, (Vector2){i->position.x, i->position.z}) < 1.0f) {
-        i->OnPickUp(i->data);
-        DeleteItem(i);
-        PlaySoundRPitch(itemPickUp);
+void PaceFrame(void) {
+    if(frameInterval <= 0) { return; }
+    double now = GetTime();
+    nextFrameTime += frameInterval;
+    //fell behind, start over from here instead of rushing the next frames
+    if(nextFrameTime < now) {
+        nextFrameTime = now;
+        return;
     }
+    WaitTime(nextFrameTime - now);
 }
 
-void UpdateItems(void) {
-    for(int i = 0; i < MAX_ITEMS; i++) {
-        if(!Items[i].active) { continue; }
-        UpdateItem(Items + i);
+void UpdatePlayerWeapon(Game* g, Player* p) {
+    int slot = p->input.weaponSlot;
+    if(slot >= 0 && slot < WT_LAST_ENTRY && p->weapons[slot].unlocked) {
+        p->selectedWeapon = slot;
+    }
+    bool fire = p->input.fireCount != p->lastFireCount;
+    p->lastFireCount = p->input.fireCount;
+    Weapon *wep = &p->weapons[p->selectedWeapon];
+    const uint now = GetAnimTick(g);
+    if(wep->ammo && fire && !GetWeaponFrame(wep, now)) {
+        wep->animStart = now;
+        wep->ammo--;
+        wep->OnShoot(g, p);
     }
 }
 
-void UpdateProjectiles(void) {
-    for(int i = 0; i < MAX_PROJECTILES; i++) {
-        Projectile* b = &Projectiles[i];
-        if(!b->active) {continue;}
-        if(b->position.y < 0 ) {
-            b->active = false;
-            DamageEnemiesRadius(b->position, 9.5f, b->damage);
-            PlaySoundRPitch(nadeExplosion);
-            continue;
-        }
+//position and bobbing come from the drawn snapshot, rotation straight from the latest input
+void UpdateViewCamera(Vector2 position, float bobbing, Vector2 rotation) {
+    cam.position = (Vector3){position.x, 1 + bobbing, position.y};
+    cam.target = Vector3Add(cam.position, GetAimDirection(rotation));
+}
 
-        for(int j = 0; j < MAX_ENEMIES; j++) {
-            if(!Enemies[j].alive) { continue; }
-            if(Vector3Distance(b->position, (Vector3){Enemies[j].position.x, 1, Enemies[j].position.y}) < 0.5f) {
-                b->active = false;
-                DamageEnemiesRadius(b->position, 9.5f, b->damage);
-                PlaySoundRPitch(nadeExplosion);
-            }
-        }
+void UpdatePlayer(Game* g, Player* p) {
+    p->rotation = p->input.rotation;
+    //Player movement
+    Vector2 oldVel = p->velocity;
+    p->velocity = Vector2Normalize(p->input.move);
+    p->velocity.x *= p->speed;
+    p->velocity.y *= p->speed;
+    p->velocity = Vector2Lerp(oldVel, p->velocity, g->deltaTime * 20);
+    Vector2 step = Vector2Rotate((Vector2){p->velocity.x * g->deltaTime, p->velocity.y * g->deltaTime}, -p->rotation.y * DEG2RAD);
+    p->position = MoveCircle(g, p->position, step, PLAYER_RADIUS);
+    p->position = Vector2Clamp(p->position, (Vector2){-WALK_EXTENT, -WALK_EXTENT}, (Vector2){WALK_EXTENT, WALK_EXTENT});
+}
+
+float GetEnemyHeight(const Enemy* e) {
+    return SPAWN_IN_TIME > 0 ? 1.0f - SIM_TO_SECONDS(e->spawnTimer) / SPAWN_IN_TIME * 1.5f : 1.0f;
+}
+
+//time since the enemy was last updated, far ones catch up on several ticks at once
+static inline simtime TakeEnemyDelta(const Game* g, Enemy* e) {
+    simtime dt = (simtime)(g->enemyClock - e->lastUpdate);
+    e->lastUpdate = g->enemyClock;
+    return dt;
+}
 
-        b->position.x += b->velocity.x * state.deltaTime * b->speed;
-        b->position.y += b->velocity.y * state.deltaTime * b->speed;
-        b->position.z += b->velocity.z * state.deltaTime * b->speed;
-        b->velocity.y -= 0.15f * state.deltaTime;
+#ifdef FIXED_SIM
+//the move is worked out in whole numbers, floats only come into it when a prop is in the way
+static inline void MoveEnemy(const Game* g, Enemy* e, simtime dt) {
+    //Q14 heading times 16.16 seconds comes out in 16.16 units once the heading's scale is taken off
+    FixedVector2 step = {
+        (fixed)((int64_t)e->velocity.x * e->speed * dt / HEADING_ONE),
+        (fixed)((int64_t)e->velocity.y * e->speed * dt / HEADING_ONE),
+    };
+    Vector2 from = GetEnemyPosition(e);
+    Vector2 delta = {(float)step.x / FIXED_ONE, (float)step.y / FIXED_ONE};
+    float t;
+    Vector2 normal;
+    if(SweepCircle(g, from, delta, ENEMY_RADIUS, &t, &normal)) {
+        SetEnemyPosition(e, MoveCircle(g, from, delta, ENEMY_RADIUS));
     }
+    else {
+        e->position.x += step.x;
+        e->position.y += step.y;
+    }
+    const fixed extent = WALK_EXTENT * FIXED_ONE;
+    e->position.x = e->position.x < -extent ? -extent : e->position.x > extent ? extent : e->position.x;
+    e->position.y = e->position.y < -extent ? -extent : e->position.y > extent ? extent : e->position.y;
 }
+#else
+static inline void MoveEnemy(const Game* g, Enemy* e, simtime dt) {
+    e->position = Vector2Clamp(MoveCircle(g, e->position, 
+        Vector2Scale(e->velocity, e->speed * dt), ENEMY_RADIUS), 
+        (Vector2){-WALK_EXTENT, -WALK_EXTENT}, (Vector2){WALK_EXTENT, WALK_EXTENT});
+}
+#endif
 
-void Update(void) {
+//the part every state shares, false while the enemy is still rising out of the ground
+static inline bool StepEnemy(Game* g, Enemy* e, Player** target, float* dist) {
+    simtime dt = TakeEnemyDelta(g, e);
+    if(e->spawnTimer > 0) {
+        e->spawnTimer -= dt;
+        return false;
+    }
+    *target = GetNearestPlayer(g, GetEnemyPosition(e), dist);
+    MoveEnemy(g, e, dt);
+    return true;
+}
+
+//keeps the due enemies nearest after the cursor by slot, ordered that way, dropping whoever is furthest once the queue is full
+void QueueSightCheck(Game* g, int enemy, int player) {
+    const int cursor = g->sightCursor[g->enemyTick % SIGHT_INTERVAL];
+    const int key = (enemy - cursor + MAX_ENEMIES) % MAX_ENEMIES;
+    int i = g->sightQueued;
+    if(i == SIGHT_CHECKS_PER_TICK) {
+        g->sightDropped = true;
+        if(key > (g->sightQueue[i - 1].enemy - cursor + MAX_ENEMIES) % MAX_ENEMIES) { return; }
+        i--;
+    }
+    else {
+        g->sightQueued++;
+    }
+    for(; i > 0 && (g->sightQueue[i - 1].enemy - cursor + MAX_ENEMIES) % MAX_ENEMIES > key; i--) {
+        g->sightQueue[i] = g->sightQueue[i - 1];
+    }
+    g->sightQueue[i] = (SightCheck){enemy, player};
+}
+
+//runs once every group has been walked, so the ones that give chase can leave the wander groups
+void RunSightChecks(Game* g) {
+    const uint now = GetAnimTick(g);
+    for(int i = 0; i < g->sightQueued; i++) {
+        Enemy* e = &g->Enemies[g->sightQueue[i].enemy];
+        if(!e->alive || e->state != ES_Wander) { continue; }
+        e->seesTarget = HasLineOfSight(g, GetEnemyPosition(e), g->Players[g->sightQueue[i].player].position);
+        if(e->seesTarget) {
+            SetEnemyFrame(e, now, 0);
+            SetEnemyState(g, e, ES_Pursue);
+        }
+    }
+    //the budget ran out, this slice starts after the last one checked next time round
+    if(g->sightDropped) {
+        g->sightCursor[g->enemyTick % SIGHT_INTERVAL] = (g->sightQueue[g->sightQueued - 1].enemy + 1) % MAX_ENEMIES;
+    }
+    g->sightQueued = 0;
+    g->sightDropped = false;
+}
+
+//groups are walked backwards from their size at the start of the tick, so an enemy that changes
+//state is neither skipped by the swap-remove nor updated a second time in its new group
+static inline void UpdateWanderGroup(Game* g, int type, int count) {
+    const EnemyGroup* group = &g->EnemyGroups[type][ES_Wander];
+    const uint now = GetAnimTick(g);
+    for(int k = count - 1; k >= 0; k--) {
+        int id = group->ids[k];
+        Enemy* e = &g->Enemies[id];
+        //far enemies are split into ENEMY_LOD_INTERVAL round-robin batches by slot, one batch per tick
+        if(e->lod == EL_Far && (id + g->enemyTick) % ENEMY_LOD_INTERVAL) { continue; }
+        Player* target;
+        float dist;
+        if(!StepEnemy(g, e, &target, &dist)) { continue; }
+        //the animation cycle paces wandering and attacks, far enemies see its end late by up to ENEMY_LOD_INTERVAL ticks
+        if(IsEnemyCycleDone(e, now)) {
+            if(GetGameRandom(g, 0, 1)) { 
+                SetEnemyHeading(e, Vector2Normalize((Vector2){GetGameRandom(g, -1, 1), GetGameRandom(g, -1, 1)})); 
+            }
+            e->animStart = now;
+        }
+        if(!target || dist >= e->detectRange) {
+            e->seesTarget = false;
+        }
+        //rechecked on a rotating slice of the slots, so the cost per tick stays flat as enemy counts grow
+        //a due enemy waits for RunSightChecks to decide whether it gives chase
+        else if(!((id + g->enemyTick) % SIGHT_INTERVAL)) {
+            QueueSightCheck(g, id, target - g->Players);
+            e->lod = EL_Full;
+            continue;
+        }
+        if(target && dist < e->detectRange && e->seesTarget) {
+            SetEnemyFrame(e, now, 0);
+            e->lod = EL_Full;
+            SetEnemyState(g, e, ES_Pursue);
+            continue;
+        }
+        e->lod = !target || dist > e->detectRange + ENEMY_LOD_MARGIN ? EL_Far : EL_Full;
+    }
+}
+
+static inline void UpdatePursueGroup(Game* g, int type, int count, void (*attack)(Game*, Player*)) {
+    const EnemyGroup* group = &g->EnemyGroups[type][ES_Pursue];
+    const uint now = GetAnimTick(g);
+    for(int k = count - 1; k >= 0; k--) {
+        Enemy* e = &g->Enemies[group->ids[k]];
+        Player* target;
+        float dist;
+        if(!StepEnemy(g, e, &target, &dist)) { continue; }
+        if(!target) {
+            SetEnemyState(g, e, ES_Wander);
+            continue;
+        }
+        SetEnemyHeading(e, Vector2Normalize(Vector2Subtract(target->position, GetEnemyPosition(e))));
+        if(IsEnemyCycleDone(e, now)) { e->animStart = now; }
+        if(dist < e->attackRange) {
+            attack(g, target);
+            SetEnemyHeading(e, Vector2Zero());
+            SetEnemyFrame(e, now, 0);
+            e->spriteRect.y += e->spriteRect.height;
+            SetEnemyState(g, e, ES_Attack);
+        }
+    }
+}
+
+static inline void UpdateAttackGroup(Game* g, int type, int count, void (*attack)(Game*, Player*)) {
+    const EnemyGroup* group = &g->EnemyGroups[type][ES_Attack];
+    const uint now = GetAnimTick(g);
+    for(int k = count - 1; k >= 0; k--) {
+        Enemy* e = &g->Enemies[group->ids[k]];
+        Player* target;
+        float dist;
+        if(!StepEnemy(g, e, &target, &dist)) { continue; }
+        if(!IsEnemyCycleDone(e, now)) { continue; }
+        if(!target || dist >= e->attackRange) {
+            SetEnemyFrame(e, now, 0);
+            e->spriteRect.y -= e->spriteRect.height;
+            SetEnemyState(g, e, ES_Pursue);
+            continue;
+        }
+        e->animStart = now;
+        attack(g, target);
+    }
+}
+
+//one loop set per archetype, the behaviour is a constant argument so it gets inlined instead of called through the enemy
+#define X(TYPE, ATTACK, DEATH) \
+    void UpdateEnemies_##TYPE(Game* g, const int* counts) { \
+        UpdateWanderGroup(g, TYPE, counts[ES_Wander]); \
+        UpdatePursueGroup(g, TYPE, counts[ES_Pursue], ATTACK); \
+        UpdateAttackGroup(g, TYPE, counts[ES_Attack], ATTACK); \
+    }
+ENEMY_ARCHETYPES(X)
+#undef X
+
+void UpdateEnemies(Game* g) {
+    AdvanceAnimClock(g, SIM_SECONDS(g->deltaTime));
+    g->enemyTick++;
+    int counts[ET_LAST_ENTRY][ES_LAST_ENTRY];
+    for(int t = 0; t < ET_LAST_ENTRY; t++) {
+        for(int s = 0; s < ES_LAST_ENTRY; s++) {
+            counts[t][s] = g->EnemyGroups[t][s].count;
+        }
+    }
+    #define X(TYPE, ATTACK, DEATH) UpdateEnemies_##TYPE(g, counts[TYPE]);
+    ENEMY_ARCHETYPES(X)
+    #undef X
+    RunSightChecks(g);
+}
+
+void UpdateItem(Game* g, Item* i) {
+    if(!i->active) { return; }
+    i->position.y = 1.0 + sin(g->unpausedTime * 10.0) * 0.01;
+    float dist;
+    Player* p = GetNearestPlayer(g, (Vector2){i->position.x, i->position.z}, &dist);
+    if(p && dist < 1.0f) {
+        i->OnPickUp(g, p, i->data);
+        DeleteItem(i);
+        PlaySoundFromPlayer(g, itemPickUp, p);
+    }
+}
+
+void UpdateItems(Game* g) {
+    for(int i = 0; i < MAX_ITEMS; i++) {
+        if(!g->Items[i].active) { continue; }
+        UpdateItem(g, g->Items + i);
+    }
+}
+
+void UpdateProjectiles(Game* g) {
+    for(int i = 0; i < MAX_PROJECTILES; i++) {
+        Projectile* b = &g->Projectiles[i];
+        if(!b->active) {continue;}
+        if(b->position.y < 0 ) {
+            b->active = false;
+            DamageEnemiesRadius(g, b->position, 9.5f, b->damage);
+            PlaySoundRPitch(g, nadeExplosion);
+            QueueEffect(g, EK_Explosion, (Vector3){b->position.x, 0.1f, b->position.z}, (Vector3){0, 1, 0});
+            continue;
+        }
+
+        for(int j = 0; j < MAX_ENEMIES; j++) {
+            if(!g->Enemies[j].alive) { continue; }
+            if(Vector3Distance(b->position, (Vector3){GetEnemyPosition(&g->Enemies[j]).x, 1, GetEnemyPosition(&g->Enemies[j]).y}) < 0.5f) {
+                b->active = false;
+                DamageEnemiesRadius(g, b->position, 9.5f, b->damage);
+                PlaySoundRPitch(g, nadeExplosion);
+                QueueEffect(g, EK_Explosion, b->position, (Vector3){0, 1, 0});
+                //one explosion already covers every other enemy it touches
+                break;
+            }
+        }
+
+        b->position.x += b->velocity.x * g->deltaTime * b->speed;
+        b->position.y += b->velocity.y * g->deltaTime * b->speed;
+        b->position.z += b->velocity.z * g->deltaTime * b->speed;
+        b->velocity.y -= 0.15f * g->deltaTime;
+    }
+}
+
+void UpdateSimulation(Game* g) {
+    g->unpausedTime += g->deltaTime;
+    for(int i = 0; i < MAX_PLAYERS; i++) {
+        if(!g->Players[i].active || !g->Players[i].alive) { continue; }
+        if(g->Players[i].bot) { g->Players[i].input = DriveBot(g, &g->Players[i]); }
+        UpdatePlayer(g, &g->Players[i]);
+        UpdatePlayerWeapon(g, &g->Players[i]);
+    }
+    UpdateEnemies(g);
+    UpdateItems(g);
+    UpdateProjectiles(g);
+    if(g->curEnemies < 1) {
+        g->curEnemies = g->curMaxEnemies += g->curWave * 10;
+        ++g->curWave;
+        if(g->curMaxEnemies > MAX_ENEMIES) {
+            g->outcome = MO_Win;
+            return;
+        }
+        SwapWaveArena(g);
+        if(g->spawnQueue.wave != g->curWave) { BeginSpawnQueue(g, g->curWave, g->curMaxEnemies); }
+        g->spawnQueue.draining = true;
+        //whatever the background preparation didn't get to
+        PrepareSpawns(g, SPAWN_QUEUE_SIZE);
+    }
+    UpdateSpawns(g);
+}
+
+void ApplyOutcome(int outcome) {
+    if(outcome == MO_GameOver) {
+        state.UpdateFunc = &UpdateGameOver;
+        state.DrawFunc = &DrawGameOver;
+    }
+    else if(outcome == MO_Win) {
+        state.DrawFunc = &DrawWin;
+        state.UpdateFunc = &UpdateWin;
+    }
+}
+
+void UpdateMusic(void) {
     UpdateMusicStream(lvl[curMusic]);
     float v = GetMusicAdaptiveVolume(&lvl[curMusic]);
     if(v < 0.001f) {
@@ -1084,38 +3363,1399 @@ void Update(void) {
     else {
         SetMusicVolume(lvl[curMusic], v);
     }
-    mouseDelta = GetMouseDelta();
-    state.deltaTime = GetFrameTime();
-    state.unpausedTime += state.deltaTime;
-    UpdateView();
-    UpdateWeapon();
-    UpdateEnemies();
-    UpdateItems();
-    UpdateProjectiles();
-    if(curEnemies < 1) {
-        curEnemies = curMaxEnemies += curWave * 10;
-        ++curWave;
-        if(curMaxEnemies > MAX_ENEMIES) {
-            state.DrawFunc = &DrawWin;
-            state.UpdateFunc = &UpdateWin;
+}
+
+//collects the tick simulated during the last frame and starts the next one, which runs while this frame draws
+void Update(void) {
+    UpdateMusic();
+    WaitSimWorker(&simWorker);
+    renderFront = !renderFront;
+    const RenderSnapshot* r = &renderSnapshots[renderFront];
+    PlaySoundEvents(r);
+    RunEffects(r);
+    ApplyOutcome(r->outcome);
+    if(r->outcome == MO_None) {
+        LatchLocalInput();
+        KickSimWorker(&simWorker, localInput, GetFrameTime(), simSpeed, &renderSnapshots[!renderFront]);
+        localInput.weaponSlot = -1;
+    }
+}
+
+//an unattended run reports the last wave and the result, then closes itself
+void EndBotMatch(void) {
+    if(!botPlayer) { return; }
+    const RenderSnapshot* r = &renderSnapshots[renderFront];
+    ReportWaveStats(&waveStats);
+    printf("Match over: %s, wave %d, score %d\n", r->outcome == MO_Win ? "win" : "game over", r->wave + 1, r->score);
+    exitRequested = true;
+}
+
+void UpdateGameOver(void) {
+    EndBotMatch();
+}
+
+void UpdateWin(void) {
+    EndBotMatch();
+}
+#pragma endregion
+#pragma region Bot
+bool IsBotWeaponUsable(const Player* p, int weapon) {
+    return p->weapons[weapon].unlocked && p->weapons[weapon].ammo;
+}
+
+//shotgun up close, launcher from a safe distance, the pistol for everything else
+int ChooseBotWeapon(const Player* p, float distance) {
+    if(distance < BOT_DANGER_RADIUS && IsBotWeaponUsable(p, WT_Shotgun)) { return WT_Shotgun; }
+    if(distance > BOT_DANGER_RADIUS + 2 && IsBotWeaponUsable(p, WT_Launcher)) { return WT_Launcher; }
+    if(IsBotWeaponUsable(p, WT_Pistol)) { return WT_Pistol; }
+    for(int i = 0; i < WT_LAST_ENTRY; i++) {
+        if(IsBotWeaponUsable(p, i)) { return i; }
+    }
+    return p->selectedWeapon;
+}
+
+//a medkit is only worth the walk when hurt, everything else always is
+bool IsBotPickupWanted(const Player* p, const Item* it) {
+    return it->OnPickUp != &OnPickUpMedkit || p->health < p->healthMax;
+}
+
+//shortest signed turn from one yaw to another, in degrees
+float GetYawDelta(float from, float to) {
+    float d = fmodf(to - from, 360.0f);
+    if(d > 180.0f) { d -= 360.0f; }
+    if(d < -180.0f) { d += 360.0f; }
+    return d;
+}
+
+//plays by the same rules as a person, everything it does goes through the PlayerInput it returns
+PlayerInput DriveBot(Game* g, Player* p) {
+    PlayerInput in = p->input;
+    in.weaponSlot = -1;
+
+    const Enemy* target = NULL;
+    float targetDist = 0;
+    Vector2 away = Vector2Zero();
+    for(int i = 0; i < MAX_ENEMIES; i++) {
+        const Enemy* e = &g->Enemies[i];
+        if(!e->alive || e->spawnTimer > 0) { continue; }
+        Vector2 to = Vector2Subtract(GetEnemyPosition(e), p->position);
+        float d = Vector2Length(to);
+        if(!target || d < targetDist) {
+            target = e;
+            targetDist = d;
+        }
+        if(d < BOT_DANGER_RADIUS && d > 0.001f) {
+            away = Vector2Subtract(away, Vector2Scale(to, (BOT_DANGER_RADIUS - d) / (BOT_DANGER_RADIUS * d)));
+        }
+    }
+    const Item* pickup = NULL;
+    float pickupDist = BOT_PICKUP_RADIUS;
+    for(int i = 0; i < MAX_ITEMS; i++) {
+        const Item* it = &g->Items[i];
+        if(!it->active || !IsBotPickupWanted(p, it)) { continue; }
+        float d = Vector2Distance(p->position, (Vector2){it->position.x, it->position.z});
+        if(d < pickupDist) {
+            pickup = it;
+            pickupDist = d;
+        }
+    }
+
+    Vector2 dir = Vector2Scale(away, 2.0f);
+    if(target) {
+        Vector2 to = Vector2Scale(Vector2Subtract(GetEnemyPosition(target), p->position), 1.0f / fmaxf(targetDist, 0.001f));
+        float yaw = atan2f(to.x, to.y) * RAD2DEG;
+        float turn = BOT_TURN_RATE * g->deltaTime;
+        in.rotation.y = fmodf(in.rotation.y + Clamp(GetYawDelta(in.rotation.y, yaw), -turn, turn) + 360.0f, 360.0f);
+        in.rotation.x = 0;
+
+        //only worth a trace within firing range, farther off it closes in either way
+        bool clear = targetDist < BOT_FIRE_RANGE && HasLineOfSight(g, p->position, GetEnemyPosition(target));
+        int weapon = ChooseBotWeapon(p, targetDist);
+        if(weapon != (int)p->selectedWeapon) { in.weaponSlot = weapon; }
+        //fires once the enemy's hit sphere is under the crosshair
+        float tolerance = atan2f(0.6f, targetDist) * RAD2DEG;
+        const Weapon* wep = &p->weapons[p->selectedWeapon];
+        if(targetDist < BOT_FIRE_RANGE && !GetWeaponFrame(wep, GetAnimTick(g)) && wep->ammo
+            && fabsf(GetYawDelta(in.rotation.y, yaw)) < tolerance && clear) {
+            in.fireCount++;
+        }
+
+        //circles the target, now and then changing direction so it doesn't run along the same arc forever
+        if(!p->botStrafe || !GetGameRandom(g, 0, 90)) { p->botStrafe = GetGameRandom(g, 0, 1) ? 1.0f : -1.0f; }
+        dir = Vector2Add(dir, Vector2Scale((Vector2){to.y, -to.x}, 0.6f * p->botStrafe));
+        //closes in on a target hidden behind a prop, the strafing carries it around the side
+        if(!pickup && (targetDist > BOT_ENGAGE_RADIUS || !clear)) { dir = Vector2Add(dir, to); }
+    }
+    if(pickup) {
+        Vector2 to = Vector2Subtract((Vector2){pickup->position.x, pickup->position.z}, p->position);
+        dir = Vector2Add(dir, Vector2Normalize(to));
+    }
+    //only while backing off, so it still goes for whatever lies along the walls
+    float edge = fmaxf(fabsf(p->position.x), fabsf(p->position.y));
+    if(Vector2LengthSqr(away) > 0 && edge > WALK_EXTENT - BOT_EDGE_MARGIN) {
+        dir = Vector2Add(dir, Vector2Scale(Vector2Normalize(p->position), -(edge - WALK_EXTENT + BOT_EDGE_MARGIN) / BOT_EDGE_MARGIN * 2.0f));
+    }
+    //movement is relative to where it faces, the inverse of what UpdatePlayer does with it
+    in.move = Vector2LengthSqr(dir) > 0.01f ? Vector2Rotate(Vector2Normalize(dir), in.rotation.y * DEG2RAD) : Vector2Zero();
+    return in;
+}
+#pragma endregion
+#pragma region Pipeline
+//light sources that can reach a chunk visible from viewer, LIGHT_SOURCE_COUNT always fits them all
+int GatherLights(const Game* g, Vector2 viewer, PointLight* lights) {
+    int count = 0;
+    const float reach = VIEW_RADIUS + CHUNK_SIZE * 1.5f;
+    //radius and color follow the light0.png stamps this replaced: 4 units per unit of scale, peak at 0.74 alpha
+    #define LIGHT(pos, scale, hex) \
+        if(Vector2Distance(viewer, pos) < reach + 4.0f * (scale)) { \
+            Color c = GetColor(hex); \
+            float k = c.a / 255.0f * 0.74f / 255.0f; \
+            lights[count++] = (PointLight){pos, 4.0f * (scale), {c.r * k, c.g * k, c.b * k}}; \
+        }
+    for(int i = 0; i < MAX_PLAYERS; i++) {
+        if(!g->Players[i].active || !g->Players[i].alive) { continue; }
+        LIGHT(g->Players[i].position, 20.0f, 0x22223222);
+        LIGHT(g->Players[i].position, 5.3f, 0x99999944);
+        LIGHT(g->Players[i].position, 5.3f * 1.2f, 0xAAAAAAAA);
+    }
+    for(int i = 0; i < MAX_PROJECTILES; i++) {
+        if(!g->Projectiles[i].active) { continue; }
+        Vector2 p = {g->Projectiles[i].position.x, g->Projectiles[i].position.z};
+        LIGHT(p, Clamp(0.0f + g->Projectiles[i].position.y/2.0f, 2.5f, 15.0f), 0xAAAAAA77);
+    }
+    for(int i = 0; i < MAX_ITEMS; i++) {
+        if(!g->Items[i].active) { continue; }
+        Vector2 p = {g->Items[i].position.x, g->Items[i].position.z};
+        LIGHT(p, 1.0f, 0xAAAAAA77);
+    }
+    #undef LIGHT
+    return count;
+}
+
+void BuildRenderSnapshot(Game* g, RenderSnapshot* r) {
+    const Player* view = g->localPlayer >= 0 ? &g->Players[g->localPlayer] : NULL;
+    r->viewPosition = view ? view->position : Vector2Zero();
+    r->viewBobbing = view ? sin(10 * g->unpausedTime) * Vector2Length(view->velocity) * 0.01 : 0;
+    r->viewRotation = view ? view->rotation : Vector2Zero();
+    int n = 0;
+    for(int i = 0; i < MAX_PROPS; i++) {
+        if(!g->Props[i].active) { continue; }
+        r->sprites[n++] = (RenderSprite){g->Props[i].position, g->Props[i].spriteRect, 2, SS_Props, WHITE};
+    }
+    for(int i = 0; i < MAX_ITEMS; i++) {
+        if(!g->Items[i].active) { continue; }
+        r->sprites[n++] = (RenderSprite){g->Items[i].position, g->Items[i].spriteRect, 1, SS_Items, WHITE};
+    }
+    for(int i = 0; i < MAX_ENEMIES; i++) {
+        const Enemy* e = &g->Enemies[i];
+        if(!e->alive) { continue; }
+        Vector2 at = GetEnemyPosition(e);
+        //enemies a client was sent arrive on their frame already and have no ticks of their own
+        Color anim = e->frameTicks ? (Color){e->frames, e->frameTicks, e->animStart & 0xFF, e->animStart >> 8 & 0xFF} : WHITE;
+        r->sprites[n++] = (RenderSprite){{at.x, GetEnemyHeight(e), at.y}, e->spriteRect, 1, SS_Enemies, anim};
+    }
+    r->spriteCount = n;
+    r->animTick = GetAnimTick(g);
+    n = 0;
+    for(int i = 0; i < MAX_PROJECTILES; i++) {
+        if(g->Projectiles[i].active) { r->projectiles[n++] = g->Projectiles[i].position; }
+    }
+    r->projectileCount = n;
+    n = 0;
+    for(int i = 0; i < MAX_PLAYERS; i++) {
+        if(g->Players[i].active && g->Players[i].alive && i != g->localPlayer) { r->players[n++] = g->Players[i].position; }
+    }
+    r->playerCount = n;
+    r->lightCount = GatherLights(g, r->viewPosition, r->lights);
+    memcpy(r->sounds, g->soundQueue, g->soundQueueCount * sizeof(SoundEvent));
+    r->soundCount = g->soundQueueCount;
+    g->soundQueueCount = 0;
+    memcpy(r->effects, g->effectQueue, g->effectQueueCount * sizeof(EffectEvent));
+    r->effectCount = g->effectQueueCount;
+    g->effectQueueCount = 0;
+    if(view) {
+        const Weapon* wep = &view->weapons[view->selectedWeapon];
+        r->weaponRect = wep->spriteRect;
+        r->weaponRect.x = GetWeaponFrame(wep, GetAnimTick(g)) * wep->spriteRect.width;
+        r->ammo = wep->ammo;
+        r->ammoCap = wep->ammoCap;
+        r->health = view->health;
+        r->healthMax = view->healthMax;
+    }
+    r->enemies = g->curEnemies;
+    r->wave = g->curWave;
+    r->score = g->score;
+    r->outcome = g->outcome;
+    r->waveArenaHighWater = MAX(g->waveArenas[0].highWater, g->waveArenas[1].highWater);
+    memcpy(r->debugRays, g->debugRays, sizeof(r->debugRays));
+}
+
+void PlaySoundEvents(const RenderSnapshot* r) {
+    if(!IsAudioDeviceReady()) { return; }
+    for(int i = 0; i < r->soundCount; i++) {
+        const SoundEvent* ev = &r->sounds[i];
+        SetSoundPitch(ev->sound, ev->pitch);
+        SetSoundVolume(ev->sound, ev->volume);
+        PlaySoundMulti(ev->sound);
+    }
+}
+
+//fast-forward runs several ticks of the frame's length back to back, only the last one gets drawn
+void RunSimulationTick(Game* g, PlayerInput input, float deltaTime, int steps, RenderSnapshot* target) {
+    g->deltaTime = deltaTime;
+    //a bot player's input is written by DriveBot alone, the main thread's would undo its aim every tick
+    if(!g->Players[g->localPlayer].bot) { g->Players[g->localPlayer].input = input; }
+    for(int i = 0; i < steps && g->outcome == MO_None; i++) {
+        double start = NetTime();
+        UpdateSimulation(g);
+        ObserveMetricTime(&metrics.tickTime, NetTime() - start);
+    }
+    PublishGameMetrics(g);
+    BuildRenderSnapshot(g, target);
+}
+
+void* SimWorkerMain(void* arg) {
+    SimWorker* w = arg;
+    pthread_mutex_lock(&w->lock);
+    for(;;) {
+        while(!w->busy && !w->quit) { pthread_cond_wait(&w->cond, &w->lock); }
+        if(w->quit) { break; }
+        //input and target stay untouched by the main thread until busy is cleared
+        pthread_mutex_unlock(&w->lock);
+        RunSimulationTick(w->game, w->input, w->deltaTime, w->steps, w->target);
+        pthread_mutex_lock(&w->lock);
+        w->busy = false;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+void StartSimWorker(SimWorker* w, Game* g) {
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    w->game = g;
+    w->busy = false;
+    w->quit = false;
+    w->running = pthread_create(&w->thread, NULL, &SimWorkerMain, w) == 0;
+    if(!w->running) { puts("Simulation thread unavailable, running ticks inline"); }
+}
+
+void KickSimWorker(SimWorker* w, PlayerInput input, float deltaTime, int steps, RenderSnapshot* target) {
+    if(!w->running) {
+        RunSimulationTick(w->game, input, deltaTime, steps, target);
+        return;
+    }
+    pthread_mutex_lock(&w->lock);
+    w->input = input;
+    w->deltaTime = deltaTime;
+    w->steps = steps;
+    w->target = target;
+    w->busy = true;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+void WaitSimWorker(SimWorker* w) {
+    if(!w->running) { return; }
+    pthread_mutex_lock(&w->lock);
+    while(w->busy) { pthread_cond_wait(&w->cond, &w->lock); }
+    pthread_mutex_unlock(&w->lock);
+}
+
+void StopSimWorker(SimWorker* w) {
+    if(!w->running) { return; }
+    WaitSimWorker(w);
+    pthread_mutex_lock(&w->lock);
+    w->quit = true;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+    w->running = false;
+}
+#pragma endregion
+#pragma region Metrics
+void ObserveMetricTime(MetricHistogram* h, double seconds) {
+    int bucket = 0;
+    while(bucket < METRICS_TIME_BUCKETS && seconds > MetricTimeBuckets[bucket]) { bucket++; }
+    atomic_fetch_add_explicit(&h->buckets[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sumMicros, (unsigned long long)(seconds * 1e6), memory_order_relaxed);
+}
+
+//gauges of the one match this process shows or serves, batch sessions only add to the counters
+void PublishGameMetrics(const Game* g) {
+    unsigned int projectiles = 0, items = 0, props = 0;
+    for(int i = 0; i < MAX_PROJECTILES; i++) { projectiles += g->Projectiles[i].active; }
+    for(int i = 0; i < MAX_ITEMS; i++) { items += g->Items[i].active; }
+    for(int i = 0; i < MAX_PROPS; i++) { props += g->Props[i].active; }
+    atomic_store_explicit(&metrics.live[MP_Enemies], MAX_ENEMIES - g->freeEnemyCount, memory_order_relaxed);
+    atomic_store_explicit(&metrics.live[MP_Projectiles], projectiles, memory_order_relaxed);
+    atomic_store_explicit(&metrics.live[MP_Items], items, memory_order_relaxed);
+    atomic_store_explicit(&metrics.live[MP_Props], props, memory_order_relaxed);
+    atomic_store_explicit(&metrics.wave, g->curWave + 1, memory_order_relaxed);
+}
+
+typedef struct {
+    char* data;
+    int size;
+    int used;
+} MetricsText;
+
+void MetricsPrintf(MetricsText* t, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(t->data + t->used, t->size - t->used, format, args);
+    va_end(args);
+    if(len > 0) { t->used = MIN(t->used + len, t->size - 1); }
+}
+
+void WriteMetricHistogram(MetricsText* t, const char* name, const char* help, const MetricHistogram* h) {
+    MetricsPrintf(t, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    unsigned long long total = 0;
+    for(int i = 0; i < METRICS_TIME_BUCKETS; i++) {
+        total += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+        MetricsPrintf(t, "%s_bucket{le=\"%g\"} %llu\n", name, MetricTimeBuckets[i], total);
+    }
+    total += atomic_load_explicit(&h->buckets[METRICS_TIME_BUCKETS], memory_order_relaxed);
+    MetricsPrintf(t, "%s_bucket{le=\"+Inf\"} %llu\n", name, total);
+    MetricsPrintf(t, "%s_sum %.6f\n", name, atomic_load_explicit(&h->sumMicros, memory_order_relaxed) / 1e6);
+    MetricsPrintf(t, "%s_count %llu\n", name, total);
+}
+
+//Prometheus text exposition format 0.0.4
+int WriteMetrics(char* buffer, int size) {
+    MetricsText t = { buffer, size, 0 };
+    MetricsPrintf(&t, "# HELP sus_entities Live entities per pool.\n# TYPE sus_entities gauge\n");
+    for(int i = 0; i < MP_LAST_ENTRY; i++) {
+        MetricsPrintf(&t, "sus_entities{pool=\"%s\"} %u\n", MetricPoolNames[i], atomic_load_explicit(&metrics.live[i], memory_order_relaxed));
+    }
+    MetricsPrintf(&t, "# HELP sus_pool_capacity Slots per pool, the compile time MAX_* limits.\n# TYPE sus_pool_capacity gauge\n");
+    for(int i = 0; i < MP_LAST_ENTRY; i++) {
+        MetricsPrintf(&t, "sus_pool_capacity{pool=\"%s\"} %d\n", MetricPoolNames[i], MetricPoolCapacity[i]);
+    }
+    MetricsPrintf(&t, "# HELP sus_spawned_total Entities spawned per pool.\n# TYPE sus_spawned_total counter\n");
+    for(int i = 0; i < MP_LAST_ENTRY; i++) {
+        MetricsPrintf(&t, "sus_spawned_total{pool=\"%s\"} %llu\n", MetricPoolNames[i], atomic_load_explicit(&metrics.spawned[i], memory_order_relaxed));
+    }
+    MetricsPrintf(&t, "# HELP sus_spawns_dropped_total Spawns lost because the pool was full.\n# TYPE sus_spawns_dropped_total counter\n");
+    for(int i = 0; i < MP_LAST_ENTRY; i++) {
+        MetricsPrintf(&t, "sus_spawns_dropped_total{pool=\"%s\"} %llu\n", MetricPoolNames[i], atomic_load_explicit(&metrics.dropped[i], memory_order_relaxed));
+    }
+    MetricsPrintf(&t, "# HELP sus_enemies_killed_total Enemies killed.\n# TYPE sus_enemies_killed_total counter\nsus_enemies_killed_total %llu\n",
+        atomic_load_explicit(&metrics.enemiesKilled, memory_order_relaxed));
+    MetricsPrintf(&t, "# HELP sus_wave Wave of the current match, starting at 1.\n# TYPE sus_wave gauge\nsus_wave %u\n",
+        atomic_load_explicit(&metrics.wave, memory_order_relaxed));
+    MetricsPrintf(&t, "# HELP sus_sound_voices Sounds playing on the mixer right now.\n# TYPE sus_sound_voices gauge\nsus_sound_voices %d\n",
+        IsAudioDeviceReady() ? GetSoundsPlaying() : 0);
+    MetricsPrintf(&t, "# HELP sus_sound_events_total Sounds queued by the simulation.\n# TYPE sus_sound_events_total counter\nsus_sound_events_total %llu\n",
+        atomic_load_explicit(&metrics.soundEvents, memory_order_relaxed));
+    MetricsPrintf(&t, "# HELP sus_sound_events_dropped_total Sounds lost to a full queue.\n# TYPE sus_sound_events_dropped_total counter\nsus_sound_events_dropped_total %llu\n",
+        atomic_load_explicit(&metrics.soundEventsDropped, memory_order_relaxed));
+    MetricsPrintf(&t, "# HELP sus_particles Live particles.\n# TYPE sus_particles gauge\nsus_particles %u\n",
+        atomic_load_explicit(&metrics.particles, memory_order_relaxed));
+    MetricsPrintf(&t, "# HELP sus_particle_budget Current particle limit, shrinks when effects cost too much of the frame.\n# TYPE sus_particle_budget gauge\nsus_particle_budget %u\n",
+        atomic_load_explicit(&metrics.particleBudget, memory_order_relaxed));
+    MetricsPrintf(&t, "# HELP sus_particles_culled_total Particles pushed out early by higher priority effects.\n# TYPE sus_particles_culled_total counter\nsus_particles_culled_total %llu\n",
+        atomic_load_explicit(&metrics.particlesCulled, memory_order_relaxed));
+    WriteMetricHistogram(&t, "sus_frame_seconds", "Time between presented frames.", &metrics.frameTime);
+    WriteMetricHistogram(&t, "sus_tick_seconds", "Time spent in one simulation tick.", &metrics.tickTime);
+    return t.used;
+}
+
+bool EnableMetrics(unsigned short port) {
+    if(!NetInit() || (metricsSocket = NetListen(port)) < 0) {
+        printf("Could not open metrics port %d\n", port);
+        return false;
+    }
+    for(int i = 0; i < METRICS_MAX_CONNECTIONS; i++) {
+        metricsConnections[i].socket = -1;
+    }
+    printf("Metrics on http://127.0.0.1:%d/metrics\n", port);
+    return true;
+}
+
+void AnswerMetricsRequest(MetricsConnection* c) {
+    static char body[METRICS_TEXT_SIZE];
+    char head[160];
+    bool found = !strncmp(c->request, "GET /metrics ", 13) || !strncmp(c->request, "GET / ", 6);
+    int len = found ? WriteMetrics(body, sizeof(body)) : 0;
+    int headLen = snprintf(head, sizeof(head), "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\nConnection: close\r\n\r\n",
+        found ? "200 OK" : "404 Not Found", len);
+    //a few KB always fit the fresh connection's send buffer, so the non-blocking writes don't come up short
+    NetWrite(c->socket, head, headLen);
+    NetWrite(c->socket, body, len);
+}
+
+//polled once per frame or server tick, never blocks
+void ServeMetrics(void) {
+    if(metricsSocket < 0) { return; }
+    double now = NetTime();
+    NetSocket incoming;
+    while((incoming = NetAccept(metricsSocket)) >= 0) {
+        MetricsConnection* slot = NULL;
+        for(int i = 0; i < METRICS_MAX_CONNECTIONS && !slot; i++) {
+            if(metricsConnections[i].socket < 0) { slot = &metricsConnections[i]; }
+        }
+        if(!slot) {
+            NetClose(incoming);
+            continue;
+        }
+        *slot = (MetricsConnection){ .socket = incoming, .opened = now };
+    }
+    for(int i = 0; i < METRICS_MAX_CONNECTIONS; i++) {
+        MetricsConnection* c = &metricsConnections[i];
+        if(c->socket < 0) { continue; }
+        int len = NetRead(c->socket, c->request + c->received, sizeof(c->request) - 1 - c->received);
+        if(len > 0) {
+            c->received += len;
+            c->request[c->received] = 0;
+        }
+        //the headers are all read before answering, closing on unread input would reset the connection
+        bool complete = strstr(c->request, "\r\n\r\n") || c->received >= (int)sizeof(c->request) - 1;
+        if(complete) { AnswerMetricsRequest(c); }
+        if(complete || len == 0 || now - c->opened > METRICS_REQUEST_TIMEOUT) {
+            NetClose(c->socket);
+            c->socket = -1;
+        }
+    }
+}
+#pragma endregion
+#pragma region Net
+int NetQuantize(float v) {
+    return (int)roundf(v * NET_POS_SCALE);
+}
+
+float NetDequantize(int v) {
+    return (float)v / NET_POS_SCALE;
+}
+
+bool NetEntityEqual(const NetEntity* a, const NetEntity* b) {
+    return a->active == b->active && a->sprite == b->sprite &&
+        a->x == b->x && a->y == b->y && a->z == b->z;
+}
+
+void CaptureSnapshot(const Game* g, NetSnapshot* snap, uint tick) {
+    snap->tick = tick;
+    snap->outcome = g->outcome;
+    snap->wave = g->curWave;
+    snap->enemies = g->curEnemies;
+    snap->score = g->score;
+    for(int i = 0; i < MAX_PLAYERS; i++) {
+        const Player* p = &g->Players[i];
+        snap->players[i] = (NetPlayer){
+            .active = p->active,
+            .alive = p->alive,
+            .weapon = p->selectedWeapon,
+            .x = NetQuantize(p->position.x),
+            .y = NetQuantize(p->position.y),
+            .rotX = (int)(p->rotation.x * 100),
+            .rotY = (int)(p->rotation.y * 100),
+        };
+    }
+    NetEntity* n = snap->entities;
+    const uint now = GetAnimTick(g);
+    for(int i = 0; i < MAX_ENEMIES; i++, n++) {
+        const Enemy* e = &g->Enemies[i];
+        if(!e->alive) { *n = (NetEntity){0}; continue; }
+        *n = (NetEntity){
+            .active = 1,
+            .sprite = GetEnemyFrame(e, now) | (int)(e->spriteRect.y / 120) << 4,
+            .x = NetQuantize(GetEnemyPosition(e).x),
+            .y = NetQuantize(GetEnemyPosition(e).y),
+            .z = NetQuantize(SIM_TO_SECONDS(e->spawnTimer)),
+        };
+    }
+    for(int i = 0; i < MAX_ITEMS; i++, n++) {
+        const Item* it = &g->Items[i];
+        if(!it->active) { *n = (NetEntity){0}; continue; }
+        *n = (NetEntity){
+            .active = 1,
+            .sprite = GetAtlasId(it->spriteRect),
+            .x = NetQuantize(it->position.x),
+            .y = NetQuantize(it->position.z),
+        };
+    }
+    for(int i = 0; i < MAX_PROJECTILES; i++, n++) {
+        const Projectile* b = &g->Projectiles[i];
+        if(!b->active) { *n = (NetEntity){0}; continue; }
+        *n = (NetEntity){
+            .active = 1,
+            .x = NetQuantize(b->position.x),
+            .y = NetQuantize(b->position.z),
+            .z = NetQuantize(b->position.y),
+        };
+    }
+}
+
+//returns false when the entity has nothing to say against the baseline
+bool WriteEntityDelta(NetBuffer* b, uint index, const NetEntity* base, NetEntity* cur) {
+    if(!cur->active) {
+        if(!base->active) { *cur = *base; return false; }
+        //only the despawn matters, keep the rest so no position deltas get sent
+        *cur = *base;
+        cur->active = 0;
+    }
+    if(NetEntityEqual(base, cur)) { return false; }
+    uint mask = (cur->active != base->active) | (cur->sprite != base->sprite) << 1 |
+        (cur->x != base->x) << 2 | (cur->y != base->y) << 3 | (cur->z != base->z) << 4;
+    NetWriteUVar(b, index + 1);
+    NetWriteByte(b, mask);
+    if(mask & 1) { NetWriteByte(b, cur->active); }
+    if(mask & 2) { NetWriteByte(b, cur->sprite); }
+    if(mask & 4) { NetWriteSVar(b, cur->x - base->x); }
+    if(mask & 8) { NetWriteSVar(b, cur->y - base->y); }
+    if(mask & 16) { NetWriteSVar(b, cur->z - base->z); }
+    return true;
+}
+
+void ReadEntityDelta(NetBuffer* b, NetEntity* e) {
+    uint mask = NetReadByte(b);
+    if(mask & 1) { e->active = NetReadByte(b); }
+    if(mask & 2) { e->sprite = NetReadByte(b); }
+    if(mask & 4) { e->x += NetReadSVar(b); }
+    if(mask & 8) { e->y += NetReadSVar(b); }
+    if(mask & 16) { e->z += NetReadSVar(b); }
+}
+
+void WriteSnapshotHeader(NetBuffer* b, const Game* g, const NetSnapshot* snap, uint baseTick, int player) {
+    NetWriteByte(b, PK_Snapshot);
+    NetWriteUVar(b, snap->tick);
+    NetWriteUVar(b, baseTick);
+    NetWriteByte(b, player);
+    NetWriteByte(b, snap->outcome);
+    NetWriteUVar(b, snap->wave);
+    NetWriteUVar(b, snap->enemies);
+    NetWriteUVar(b, snap->score);
+    const Player* p = &g->Players[player];
+    NetWriteSVar(b, p->health);
+    NetWriteSVar(b, p->healthMax);
+    NetWriteByte(b, p->selectedWeapon);
+    for(int i = 0; i < WT_LAST_ENTRY; i++) {
+        NetWriteByte(b, p->weapons[i].unlocked);
+        NetWriteUVar(b, p->weapons[i].ammo);
+        NetWriteUVar(b, p->weapons[i].ammoCap);
+    }
+    for(int i = 0; i < MAX_PLAYERS; i++) {
+        const NetPlayer* np = &snap->players[i];
+        NetWriteByte(b, np->active);
+        if(!np->active) { continue; }
+        NetWriteByte(b, np->alive);
+        NetWriteByte(b, np->weapon);
+        NetWriteSVar(b, np->x);
+        NetWriteSVar(b, np->y);
+        NetWriteSVar(b, np->rotX);
+        NetWriteSVar(b, np->rotY);
+    }
+}
+
+//delta against the last snapshot the peer acked, nearby entities first, the rest round-robin until the budget runs out
+void SendSnapshot(const Game* g, int peerId) {
+    NetPeer* peer = &Peers[peerId];
+    const NetSnapshot* cur = &netCurrent;
+    const NetSnapshot* base = &netEmpty;
+    uint baseTick = 0;
+    const NetSnapshot* acked = &PeerHistory[peerId][peer->ackTick % NET_HISTORY];
+    if(peer->ackTick && acked->tick == peer->ackTick) {
+        base = acked;
+        baseTick = peer->ackTick;
+    }
+    //what the peer will hold once this arrives, unsent entities keep their baseline
+    memcpy(netSent.entities, base->entities, sizeof(netSent.entities));
+
+    unsigned char packet[NET_PACKET_BUDGET];
+    NetBuffer b = NetBufferWrap(packet, sizeof(packet));
+    WriteSnapshotHeader(&b, g, cur, baseTick, peer->player);
+
+    const int limit = NET_PACKET_BUDGET - NET_ENTITY_MAX_BYTES - 1;
+    const Player* p = &g->Players[peer->player];
+    const int ox = NetQuantize(p->position.x), oy = NetQuantize(p->position.y);
+    const long long radius = (long long)(NET_RELEVANT_RADIUS * NET_POS_SCALE);
+    for(int i = 0; i < NET_ENTITY_COUNT && b.cursor < limit; i++) {
+        const NetEntity* c = &cur->entities[i];
+        long long dx = c->x - ox, dy = c->y - oy;
+        if(dx * dx + dy * dy > radius * radius) { continue; }
+        NetEntity e = *c;
+        if(WriteEntityDelta(&b, i, &base->entities[i], &e)) {
+            netSent.entities[i] = e;
+        }
+    }
+    int k = 0;
+    for(; k < NET_ENTITY_COUNT && b.cursor < limit; k++) {
+        int i = (peer->cursor + k) % NET_ENTITY_COUNT;
+        NetEntity e = cur->entities[i];
+        if(WriteEntityDelta(&b, i, &netSent.entities[i], &e)) {
+            netSent.entities[i] = e;
+        }
+    }
+    peer->cursor = (peer->cursor + k) % NET_ENTITY_COUNT;
+    NetWriteUVar(&b, 0);
+
+    NetSnapshot* slot = &PeerHistory[peerId][cur->tick % NET_HISTORY];
+    slot->tick = cur->tick;
+    memcpy(slot->entities, netSent.entities, sizeof(slot->entities));
+    NetSend(serverSocket, peer->address, packet, b.cursor);
+    peer->bytesSent += b.cursor;
+}
+
+//the live props go out in parts of NET_WELCOME_PROPS, one packet each, every join request gets all of them again
+void SendWelcome(const Game* g, const NetPeer* peer) {
+    int count = 0;
+    for(int i = 0; i < MAX_PROPS; i++) {
+        count += g->Props[i].active;
+    }
+    const int parts = count ? (count + NET_WELCOME_PROPS - 1) / NET_WELCOME_PROPS : 1;
+    int i = 0;
+    for(int part = 0; part < parts; part++) {
+        unsigned char packet[NET_PACKET_BUDGET];
+        NetBuffer b = NetBufferWrap(packet, sizeof(packet));
+        NetWriteByte(&b, PK_Welcome);
+        NetWriteByte(&b, peer->player);
+        NetWriteUVar(&b, part);
+        NetWriteUVar(&b, parts);
+        const int n = part + 1 < parts ? NET_WELCOME_PROPS : count - part * NET_WELCOME_PROPS;
+        NetWriteUVar(&b, n);
+        for(int k = 0; k < n; i++) {
+            if(!g->Props[i].active) { continue; }
+            NetWriteByte(&b, GetAtlasId(g->Props[i].spriteRect));
+            NetWriteSVar(&b, NetQuantize(g->Props[i].position.x));
+            NetWriteSVar(&b, NetQuantize(g->Props[i].position.z));
+            k++;
+        }
+        if(b.overflow) {
+            printf("Welcome part %d of %d does not fit %d bytes\n", part, parts, NET_PACKET_BUDGET);
             return;
         }
-        for(int i = 0; i < curMaxEnemies; i++) {
-            SpawnEnemy(GetRandomValue(0, MIN(curWave, ET_LAST_ENTRY-1)), GetRandomValue(-90, 90), GetRandomValue(-90, 90));
+        NetSend(serverSocket, peer->address, packet, b.cursor);
+    }
+}
+
+NetPeer* FindPeer(NetAddress address) {
+    for(int i = 0; i < MAX_PLAYERS; i++) {
+        if(Peers[i].connected && NetAddressEqual(Peers[i].address, address)) { return &Peers[i]; }
+    }
+    return NULL;
+}
+
+void DisconnectPeer(Game* g, NetPeer* peer) {
+    printf("Player %d left\n", peer->player);
+    peer->connected = false;
+    g->Players[peer->player].active = false;
+}
+
+void HandleServerPacket(Game* g, NetAddress from, NetBuffer* b, uint tick) {
+    uint type = NetReadByte(b);
+    NetPeer* peer = FindPeer(from);
+    if(type == PK_Join) {
+        if(!peer) {
+            for(int i = 0; i < MAX_PLAYERS; i++) {
+                if(Peers[i].connected || g->Players[i].active) { continue; }
+                peer = &Peers[i];
+                *peer = (NetPeer){ .connected = true, .address = from, .player = i };
+                InitPlayer(g, &g->Players[i], i);
+                printf("Player %d joined\n", i);
+                break;
+            }
         }
-        int numItems = GetRandomValue(3, 7);
-        for(int i = 0; i < numItems; i++) {
-            SpawnAmmo(Clamp(GetRandomValue(-3,WT_LAST_ENTRY-1), 0, WT_LAST_ENTRY-1), GetRandomValue(15, 30), 
-                GetRandomValue(-MAP_SIZE/2+28, MAP_SIZE/2-28), GetRandomValue(-MAP_SIZE/2+28, MAP_SIZE/2-28));
+        if(!peer) { return; }
+        SendWelcome(g, peer);
+    }
+    if(!peer) { return; }
+    peer->lastHeard = NetTime();
+    if(type == PK_Input) {
+        uint seq = NetReadUVar(b);
+        uint ack = NetReadUVar(b);
+        PlayerInput in = {0};
+        in.rotation.x = NetReadSVar(b) / 100.0f;
+        in.rotation.y = NetReadSVar(b) / 100.0f;
+        in.move.x = NetReadSVar(b) / 127.0f;
+        in.move.y = NetReadSVar(b) / 127.0f;
+        in.fireCount = NetReadUVar(b);
+        in.weaponSlot = NetReadSVar(b);
+        if(b->overflow || seq <= peer->lastInputSeq) { return; }
+        peer->lastInputSeq = seq;
+        if(ack > peer->ackTick && ack <= tick) { peer->ackTick = ack; }
+        in.rotation.x = Clamp(in.rotation.x, -80, 80);
+        in.move = Vector2Clamp(in.move, (Vector2){-1, -1}, (Vector2){1, 1});
+        g->Players[peer->player].input = in;
+    }
+    else if(type == PK_Leave) {
+        DisconnectPeer(g, peer);
+    }
+}
+
+int startServer(unsigned short port)
+{
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    if(!NetInit() || (serverSocket = NetOpen(port)) < 0) {
+        printf("Could not open UDP port %d\n", port);
+        return 1;
+    }
+    //no local player, every seat belongs to a peer
+    Game* g = NewGame((uint)time(NULL));
+    SpawnWorld(g);
+    printf("Server listening on UDP port %d, %d Hz, %d byte snapshots\n", port, NET_TICK_RATE, NET_PACKET_BUDGET);
+
+    const double dt = 1.0 / NET_TICK_RATE;
+    uint tick = 0;
+    uint endTick = 0;
+    double nextTick = NetTime();
+    double statsTime = nextTick;
+    double simTime = 0;
+    uint simTicks = 0;
+    unsigned char packet[2048];
+    while (true)
+    {
+        NetAddress from;
+        int len;
+        while((len = NetReceive(serverSocket, &from, packet, sizeof(packet))) >= 0) {
+            NetBuffer b = NetBufferWrap(packet, len);
+            HandleServerPacket(g, from, &b, tick);
+        }
+        double now = NetTime();
+        for(int i = 0; i < MAX_PLAYERS; i++) {
+            if(Peers[i].connected && now - Peers[i].lastHeard > NET_TIMEOUT) { DisconnectPeer(g, &Peers[i]); }
+        }
+
+        g->deltaTime = dt;
+        if(!g->outcome) {
+            UpdateSimulation(g);
+        }
+        ++tick;
+        CaptureSnapshot(g, &netCurrent, tick);
+        for(int i = 0; i < MAX_PLAYERS; i++) {
+            if(Peers[i].connected) { SendSnapshot(g, i); }
+        }
+        double tickTime = NetTime() - now;
+        simTime += tickTime;
+        simTicks++;
+        ObserveMetricTime(&metrics.tickTime, tickTime);
+        PublishGameMetrics(g);
+        ServeMetrics();
+
+        if(now - statsTime >= 5.0) {
+            int peers = 0;
+            uint bytes = 0;
+            for(int i = 0; i < MAX_PLAYERS; i++) {
+                if(!Peers[i].connected) { continue; }
+                peers++;
+                bytes += Peers[i].bytesSent;
+                Peers[i].bytesSent = 0;
+            }
+            printf("tick %u: %d players, wave %d, %d enemies, %.3f ms/tick, %.1f KB/s per client\n",
+                tick, peers, g->curWave + 1, g->curEnemies, simTime * 1000.0 / simTicks,
+                peers ? bytes / 1024.0 / (now - statsTime) / peers : 0.0);
+            statsTime = now;
+            simTime = 0;
+            simTicks = 0;
+        }
+        if(g->outcome) {
+            if(!endTick) {
+                endTick = tick;
+                printf("Match over: %s, score %d\n", g->outcome == MO_Win ? "win" : "game over", g->score);
+                ReportArenas(g);
+            }
+            //keep broadcasting the outcome for a bit so clients see it
+            else if(tick - endTick > 3 * NET_TICK_RATE) { break; }
         }
+
+        nextTick += dt;
+        now = NetTime();
+        if(nextTick < now - 1.0) { nextTick = now; }
+        NetSleep(nextTick - now);
     }
+    FreeGame(g);
+    NetClose(serverSocket);
+    NetShutdown();
+    return 0;
 }
 
-void UpdateGameOver(void) {
+bool NetClientConnect(NetClient* c, const char* host, unsigned short port, Game* world) {
+    *c = (NetClient){ .socket = NetOpen(0), .world = world };
+    if(c->socket < 0 || !NetResolve(host, port, &c->server)) {
+        printf("Could not reach %s:%d\n", host, port);
+        NetClose(c->socket);
+        c->socket = -1;
+        return false;
+    }
+    c->history = calloc(NET_HISTORY, sizeof(NetSnapshot));
+    return c->history != NULL;
+}
 
+void NetClientDisconnect(NetClient* c) {
+    if(c->socket < 0) { return; }
+    unsigned char leave = PK_Leave;
+    NetSend(c->socket, c->server, &leave, 1);
+    NetClose(c->socket);
+    free(c->history);
+    c->socket = -1;
+    c->history = NULL;
 }
 
-void UpdateWin(void) {
+void HandleWelcome(NetClient* c, NetBuffer* b) {
+    int player = NetReadByte(b);
+    uint part = NetReadUVar(b);
+    uint parts = NetReadUVar(b);
+    if(b->overflow || player >= MAX_PLAYERS || part >= parts || parts > NET_WELCOME_PARTS) { return; }
+    if(c->joined && player != c->player) { return; }
+    Game* g = c->world;
+    //the first part to arrive joins, whichever it is
+    if(!c->joined) {
+        c->player = player;
+        c->joined = true;
+        c->welcomeMissing = parts;
+        memset(c->welcomeSeen, 0, sizeof(c->welcomeSeen));
+        if(g) {
+            g->localPlayer = player;
+            InitPlayer(g, &g->Players[player], player);
+            memset(g->Props, 0, sizeof(g->Props));
+        }
+    }
+    if(c->welcomeSeen[part / 8] & 1 << part % 8) { return; }
+    c->welcomeSeen[part / 8] |= 1 << part % 8;
+    c->welcomeMissing--;
+    if(!g) { return; }
+    int count = NetReadUVar(b);
+    for(int i = 0; i < count && !b->overflow; i++) {
+        int sprite = NetReadByte(b);
+        float x = NetDequantize(NetReadSVar(b));
+        float y = NetDequantize(NetReadSVar(b));
+        if(!b->overflow) { SpawnProp(g, sprite, x, y); }
+    }
+}
+
+bool DecodeSnapshot(NetClient* c, NetBuffer* b) {
+    static NetSnapshot scratch;
+    uint tick = NetReadUVar(b);
+    uint baseTick = NetReadUVar(b);
+    if(tick <= c->latestTick) { return false; }
+    const NetSnapshot* base = &netEmpty;
+    if(baseTick) {
+        base = &c->history[baseTick % NET_HISTORY];
+        if(base->tick != baseTick) { return false; }
+    }
+    memcpy(scratch.entities, base->entities, sizeof(scratch.entities));
+    scratch.tick = tick;
+    NetReadByte(b);
+    scratch.outcome = NetReadByte(b);
+    scratch.wave = NetReadUVar(b);
+    scratch.enemies = NetReadUVar(b);
+    scratch.score = NetReadUVar(b);
+    NetSelf* self = &scratch.self;
+    self->health = NetReadSVar(b);
+    self->healthMax = NetReadSVar(b);
+    self->selectedWeapon = NetReadByte(b) % WT_LAST_ENTRY;
+    for(int i = 0; i < WT_LAST_ENTRY; i++) {
+        self->unlocked[i] = NetReadByte(b);
+        self->ammo[i] = NetReadUVar(b);
+        self->ammoCap[i] = NetReadUVar(b);
+    }
+    for(int i = 0; i < MAX_PLAYERS; i++) {
+        NetPlayer* np = &scratch.players[i];
+        *np = (NetPlayer){ .active = NetReadByte(b) };
+        if(!np->active) { continue; }
+        np->alive = NetReadByte(b);
+        np->weapon = NetReadByte(b);
+        np->x = NetReadSVar(b);
+        np->y = NetReadSVar(b);
+        np->rotX = NetReadSVar(b);
+        np->rotY = NetReadSVar(b);
+    }
+    uint index;
+    while((index = NetReadUVar(b)) && !b->overflow) {
+        if(index > NET_ENTITY_COUNT) { return false; }
+        ReadEntityDelta(b, &scratch.entities[index - 1]);
+    }
+    if(b->overflow) { return false; }
+    memcpy(&c->history[tick % NET_HISTORY], &scratch, sizeof(scratch));
+    c->latestTick = tick;
+    return true;
+}
+
+void NetClientPoll(NetClient* c) {
+    unsigned char packet[2048];
+    NetAddress from;
+    int len;
+    while((len = NetReceive(c->socket, &from, packet, sizeof(packet))) >= 0) {
+        if(!NetAddressEqual(from, c->server)) { continue; }
+        c->bytesReceived += len;
+        NetBuffer b = NetBufferWrap(packet, len);
+        uint type = NetReadByte(&b);
+        if(type == PK_Welcome) {
+            HandleWelcome(c, &b);
+        }
+        else if(type == PK_Snapshot && c->joined) {
+            if(DecodeSnapshot(c, &b)) { c->snapshotsReceived++; }
+            else { c->snapshotsDropped++; }
+        }
+    }
+    double now = NetTime();
+    if((!c->joined || c->welcomeMissing > 0) && now - c->lastJoin > 0.25) {
+        unsigned char join = PK_Join;
+        NetSend(c->socket, c->server, &join, 1);
+        c->lastJoin = now;
+    }
+}
 
+void NetClientSendInput(NetClient* c, const PlayerInput* in) {
+    if(!c->joined) { return; }
+    unsigned char packet[64];
+    NetBuffer b = NetBufferWrap(packet, sizeof(packet));
+    NetWriteByte(&b, PK_Input);
+    NetWriteUVar(&b, ++c->inputSeq);
+    NetWriteUVar(&b, c->latestTick);
+    NetWriteSVar(&b, (int)(in->rotation.x * 100));
+    NetWriteSVar(&b, (int)(in->rotation.y * 100));
+    NetWriteSVar(&b, (int)(in->move.x * 127));
+    NetWriteSVar(&b, (int)(in->move.y * 127));
+    NetWriteUVar(&b, in->fireCount);
+    NetWriteSVar(&b, in->weaponSlot);
+    NetSend(c->socket, c->server, packet, b.cursor);
 }
-#pragma endregion
\ No newline at end of file
+
+const NetSnapshot* FindClientSnapshot(const NetClient* c, uint tick) {
+    const NetSnapshot* snap = &c->history[tick % NET_HISTORY];
+    return tick && snap->tick == tick ? snap : NULL;
+}
+
+Vector2 LerpNetPosition(int ax, int ay, int bx, int by, float t) {
+    return (Vector2){
+        NetDequantize(ax) + (NetDequantize(bx) - NetDequantize(ax)) * t,
+        NetDequantize(ay) + (NetDequantize(by) - NetDequantize(ay)) * t,
+    };
+}
+
+//renders NET_INTERP_TICKS behind the newest snapshot so there is always a pair to blend between
+void ApplyClientSnapshot(NetClient* c) {
+    Game* g = c->world;
+    if(!c->latestTick || !g) { return; }
+    double target = (double)c->latestTick - NET_INTERP_TICKS;
+    c->renderTick += g->deltaTime * NET_TICK_RATE;
+    if(fabs(c->renderTick - target) > 4) {
+        c->renderTick = target;
+    }
+    else {
+        c->renderTick += (target - c->renderTick) * 0.05;
+    }
+    uint t0 = c->renderTick > 0 ? (uint)c->renderTick : 0;
+    float t = (float)(c->renderTick - t0);
+    const NetSnapshot* latest = FindClientSnapshot(c, c->latestTick);
+    const NetSnapshot* a = FindClientSnapshot(c, t0);
+    const NetSnapshot* b = FindClientSnapshot(c, t0 + 1);
+    if(!a && !b) { a = b = latest; }
+    else if(!a) { a = b; }
+    else if(!b) { b = a; }
+
+    g->outcome = latest->outcome;
+    g->curWave = latest->wave;
+    g->curEnemies = latest->enemies;
+    g->score = latest->score;
+    Player* self = &g->Players[g->localPlayer];
+    self->health = latest->self.health;
+    self->healthMax = latest->self.healthMax;
+    self->selectedWeapon = latest->self.selectedWeapon;
+    for(int i = 0; i < WT_LAST_ENTRY; i++) {
+        self->weapons[i].unlocked = latest->self.unlocked[i];
+        self->weapons[i].ammo = latest->self.ammo[i];
+        self->weapons[i].ammoCap = latest->self.ammoCap[i];
+    }
+    for(int i = 0; i < MAX_PLAYERS; i++) {
+        const NetPlayer* pa = &a->players[i];
+        const NetPlayer* pb = &b->players[i];
+        Player* p = &g->Players[i];
+        p->active = pb->active;
+        p->alive = pb->alive;
+        if(!pb->active) { continue; }
+        p->position = pa->active ? LerpNetPosition(pa->x, pa->y, pb->x, pb->y, t) :
+            (Vector2){NetDequantize(pb->x), NetDequantize(pb->y)};
+        if(i != g->localPlayer) {
+            p->rotation = (Vector2){pb->rotX / 100.0f, pb->rotY / 100.0f};
+            p->selectedWeapon = pb->weapon % WT_LAST_ENTRY;
+        }
+    }
+    const NetEntity* ea = a->entities;
+    const NetEntity* eb = b->entities;
+    for(int i = 0; i < MAX_ENEMIES; i++, ea++, eb++) {
+        Enemy* e = &g->Enemies[i];
+        e->alive = eb->active;
+        if(!eb->active) { continue; }
+        SetEnemyPosition(e, ea->active ? LerpNetPosition(ea->x, ea->y, eb->x, eb->y, t) :
+            (Vector2){NetDequantize(eb->x), NetDequantize(eb->y)});
+        e->spriteRect = (Rectangle){(eb->sprite & 15) * 120, (eb->sprite >> 4) * 120, 120, 120};
+        e->frameTicks = 0;
+        e->spawnTimer = SIM_SECONDS(NetDequantize(eb->z));
+    }
+    for(int i = 0; i < MAX_ITEMS; i++, ea++, eb++) {
+        Item* it = &g->Items[i];
+        it->active = eb->active;
+        if(!eb->active) { continue; }
+        it->position = (Vector3){NetDequantize(eb->x), 1, NetDequantize(eb->y)};
+        it->spriteRect = GetAtlasRect(eb->sprite);
+    }
+    for(int i = 0; i < MAX_PROJECTILES; i++, ea++, eb++) {
+        Projectile* pr = &g->Projectiles[i];
+        pr->active = eb->active;
+        if(!eb->active) { continue; }
+        Vector2 xz = ea->active ? LerpNetPosition(ea->x, ea->y, eb->x, eb->y, t) :
+            (Vector2){NetDequantize(eb->x), NetDequantize(eb->y)};
+        float za = NetDequantize(ea->active ? ea->z : eb->z);
+        pr->position = (Vector3){xz.x, za + (NetDequantize(eb->z) - za) * t, xz.y};
+    }
+}
+
+void UpdateClient(void) {
+    Game* g = game;
+    UpdateMusic();
+    g->deltaTime = GetFrameTime();
+    g->unpausedTime += g->deltaTime;
+    Player* p = &g->Players[g->localPlayer];
+    LatchLocalInput();
+    PlayerInput in = localInput;
+    if(in.weaponSlot >= 0 && p->weapons[in.weaponSlot].unlocked) {
+        netDesiredWeapon = in.weaponSlot;
+    }
+    localInput.weaponSlot = -1;
+    in.weaponSlot = netDesiredWeapon;
+    //the shot itself happens on the server, this is only the local feedback
+    //no enemies are simulated here, the clock only times the weapon
+    AdvanceAnimClock(g, SIM_SECONDS(g->deltaTime));
+    Weapon* wep = &p->weapons[p->selectedWeapon];
+    const uint now = GetAnimTick(g);
+    if(wep->ammo && in.fireCount != p->lastFireCount && !GetWeaponFrame(wep, now)) {
+        wep->animStart = now;
+        if(p->selectedWeapon == WT_Pistol) { PlaySoundRPitch(g, revShoot); }
+        else if(p->selectedWeapon == WT_Shotgun) { PlaySoundRPitch(g, sgunShoot); }
+        QueueMuzzleFlash(g, p);
+    }
+    p->lastFireCount = in.fireCount;
+    p->input = in;
+
+    NetClientPoll(&netClient);
+    NetClientSendInput(&netClient, &in);
+    ApplyClientSnapshot(&netClient);
+    PublishGameMetrics(g);
+    p = &g->Players[g->localPlayer];
+    p->rotation = in.rotation;
+    p->velocity = Vector2Scale(Vector2Normalize(in.move), p->speed);
+    //nothing runs in the background here, the snapshot is built and drawn in the same frame
+    const RenderSnapshot* r = &renderSnapshots[renderFront];
+    BuildRenderSnapshot(g, &renderSnapshots[renderFront]);
+    PlaySoundEvents(r);
+    RunEffects(r);
+    ApplyOutcome(r->outcome);
+}
+
+int startClient(bool drawDebug, const char* host, unsigned short port, int fps)
+{
+    debug = drawDebug;
+    frameRate = fps;
+    game = NewGame((uint)time(NULL));
+    game->debug = drawDebug;
+    //stands in until the welcome assigns the real seat
+    game->localPlayer = 0;
+    if(!NetInit() || !NetClientConnect(&netClient, host, port, game)) {
+        FreeGame(game);
+        game = NULL;
+        return 1;
+    }
+    OpenGameWindow();
+    InitPlayer(game, &game->Players[game->localPlayer], game->localPlayer);
+    localInput = game->Players[game->localPlayer].input;
+    state.DrawFunc = &Draw;
+    state.UpdateFunc = &UpdateClient;
+    RunGameLoop();
+    NetClientDisconnect(&netClient);
+    NetShutdown();
+    return 0;
+}
+
+//headless clients wandering and shooting at random, for load testing a server over localhost
+//disconnecting a client that never got a socket does nothing, so this also cleans up after a failed connect
+void FreeBots(NetClient* bots, PlayerInput* inputs, int count) {
+    for(int i = 0; bots && i < count; i++) {
+        NetClientDisconnect(&bots[i]);
+    }
+    free(bots);
+    free(inputs);
+    NetShutdown();
+}
+
+int startBots(int count, const char* host, unsigned short port)
+{
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    if(count < 1 || !NetInit()) { return 1; }
+    NetClient* bots = calloc(count, sizeof(NetClient));
+    PlayerInput* inputs = calloc(count, sizeof(PlayerInput));
+    if(!bots || !inputs) {
+        FreeBots(NULL, inputs, 0);
+        free(bots);
+        return 1;
+    }
+    for(int i = 0; i < count; i++) {
+        bots[i].socket = -1;
+    }
+    for(int i = 0; i < count; i++) {
+        if(!NetClientConnect(&bots[i], host, port, NULL)) {
+            FreeBots(bots, inputs, count);
+            return 1;
+        }
+        inputs[i].weaponSlot = -1;
+    }
+    SetRandomSeed((uint)time(NULL));
+    double start = NetTime();
+    double statsTime = start;
+    double lastSnapshot = start;
+    uint received = 0;
+    while (true)
+    {
+        double now = NetTime();
+        for(int i = 0; i < count; i++) {
+            NetClient* c = &bots[i];
+            PlayerInput* in = &inputs[i];
+            uint before = c->snapshotsReceived;
+            NetClientPoll(c);
+            if(c->snapshotsReceived != before) {
+                received += c->snapshotsReceived - before;
+                lastSnapshot = now;
+            }
+            if(!GetRandomValue(0, 60)) {
+                in->move = (Vector2){GetRandomValue(-1, 1), GetRandomValue(-1, 1)};
+            }
+            in->rotation.y = fmodf(in->rotation.y + GetRandomValue(-20, 20) * 0.1f + 360.0f, 360.0f);
+            if(!GetRandomValue(0, 20)) { in->fireCount++; }
+            if(!GetRandomValue(0, 300)) { in->weaponSlot = GetRandomValue(0, WT_LAST_ENTRY - 1); }
+            NetClientSendInput(c, in);
+        }
+        if(now - statsTime >= 5.0) {
+            for(int i = 0; i < count; i++) {
+                NetClient* c = &bots[i];
+                printf("bot %d (player %d): %.1f KB/s, %u snapshots, %u dropped, tick %u\n", i, c->player,
+                    c->bytesReceived / 1024.0 / (now - statsTime), c->snapshotsReceived, c->snapshotsDropped, c->latestTick);
+                c->bytesReceived = 0;
+                c->snapshotsReceived = 0;
+                c->snapshotsDropped = 0;
+            }
+            statsTime = now;
+        }
+        if(now - lastSnapshot > NET_TIMEOUT) { break; }
+        NetSleep(1.0 / 60.0);
+    }
+    printf("Server went quiet after %.0f s\n", NetTime() - start);
+    FreeBots(bots, inputs, count);
+    return received ? 0 : 1;
+}
+#pragma endregion
+
+#pragma region State
+//FNV-1a
+static inline uint64_t HashBytes(uint64_t h, const void* data, size_t size) {
+    const unsigned char* p = data;
+    for(size_t i = 0; i < size; i++) {
+        h = (h ^ p[i]) * 0x100000001B3ull;
+    }
+    return h;
+}
+
+#define HASH_FIELD(h, field) h = HashBytes(h, &(field), sizeof(field))
+
+//field by field over what the simulation decides, padding, pointers and anything only drawn are left out
+uint64_t HashGame(const Game* g) {
+    uint64_t h = 0xCBF29CE484222325ull;
+    HASH_FIELD(h, g->rng);
+    HASH_FIELD(h, g->score);
+    HASH_FIELD(h, g->curWave);
+    HASH_FIELD(h, g->curEnemies);
+    HASH_FIELD(h, g->outcome);
+    HASH_FIELD(h, g->sightCursor);
+    for(int i = 0; i < MAX_PLAYERS; i++) {
+        const Player* p = &g->Players[i];
+        if(!p->active) { continue; }
+        HASH_FIELD(h, p->alive);
+        HASH_FIELD(h, p->position);
+        HASH_FIELD(h, p->health);
+        HASH_FIELD(h, p->selectedWeapon);
+        for(int w = 0; w < WT_LAST_ENTRY; w++) {
+            HASH_FIELD(h, p->weapons[w].ammo);
+            HASH_FIELD(h, p->weapons[w].animStart);
+        }
+    }
+    for(int i = 0; i < MAX_ENEMIES; i++) {
+        const Enemy* e = &g->Enemies[i];
+        HASH_FIELD(h, e->alive);
+        if(!e->alive) { continue; }
+        HASH_FIELD(h, e->health);
+        HASH_FIELD(h, e->state);
+        HASH_FIELD(h, e->animStart);
+        HASH_FIELD(h, e->spawnTimer);
+        HASH_FIELD(h, e->position);
+        HASH_FIELD(h, e->velocity);
+    }
+    for(int i = 0; i < MAX_PROJECTILES; i++) {
+        HASH_FIELD(h, g->Projectiles[i].active);
+        if(g->Projectiles[i].active) { HASH_FIELD(h, g->Projectiles[i].position); }
+    }
+    for(int i = 0; i < MAX_ITEMS; i++) {
+        HASH_FIELD(h, g->Items[i].active);
+        if(g->Items[i].active) { HASH_FIELD(h, g->Items[i].position); }
+    }
+    return h;
+}
+
+//bytes each kind of entity takes in a match, with what the pools around it add per slot
+int startMemoryReport(void)
+{
+#ifdef FIXED_SIM
+    printf("Simulation state per entity, FIXED_SIM build with fixed point enemies\n");
+#else
+    printf("Simulation state per entity, floating point build (FIXED_SIM for fixed point enemies)\n");
+#endif
+    //an enemy slot also has a place in every group list of its archetype and in the free list
+    size_t enemySlot = sizeof(Enemy) + ES_LAST_ENTRY * ET_LAST_ENTRY * sizeof(int) + sizeof(int);
+    struct { const char* name; size_t size; size_t slot; int capacity; } rows[] = {
+        {"enemy", sizeof(Enemy), enemySlot, MAX_ENEMIES},
+        {"projectile", sizeof(Projectile), sizeof(Projectile), MAX_PROJECTILES},
+        {"item", sizeof(Item), sizeof(Item), MAX_ITEMS},
+        {"prop", sizeof(Prop), sizeof(Prop) + sizeof(Vector2), MAX_PROPS},
+        {"player", sizeof(Player), sizeof(Player), MAX_PLAYERS},
+    };
+    printf("%-12s %8s %8s %10s %10s\n", "entity", "bytes", "slot", "capacity", "pool KB");
+    for(size_t i = 0; i < sizeof(rows) / sizeof(rows[0]); i++) {
+        printf("%-12s %8zu %8zu %10d %10.1f\n", rows[i].name, rows[i].size, rows[i].slot, rows[i].capacity,
+            rows[i].slot * (double)rows[i].capacity / 1024.0);
+    }
+    printf("whole match %.1f KB, of which %.1f KB sight and collision grids for up to %d prop chunks\n", sizeof(Game) / 1024.0,
+        (sizeof(((Game*)0)->propChunks) + sizeof(((Game*)0)->propChunkTable)) / 1024.0, MAX_PROP_CHUNKS);
+    return 0;
+}
+#pragma endregion
+#pragma region Batch
+void RunBatchSession(BatchSession* s, uint ticks) {
+    double start = NetTime();
+    Game* g = NewGame(s->seed);
+    if(!g) { return; }
+    //nobody listens, so no local player and no sound queue
+    Player* p = &g->Players[0];
+    InitPlayer(g, p, 0);
+    p->bot = true;
+    SpawnWorld(g);
+    g->deltaTime = 1.0f / BATCH_TICK_RATE;
+    uint tick = 0;
+    while(tick < ticks && g->outcome == MO_None) {
+        UpdateSimulation(g);
+        tick++;
+    }
+    s->ticks = tick;
+    s->wave = g->curWave + 1;
+    s->score = g->score;
+    s->outcome = g->outcome;
+    s->state = HashGame(g);
+    FreeGame(g);
+    s->seconds = NetTime() - start;
+}
+
+void* BatchWorkerMain(void* arg) {
+    BatchRun* run = arg;
+    for(;;) {
+        pthread_mutex_lock(&run->lock);
+        int i = run->next < run->count ? run->next++ : -1;
+        pthread_mutex_unlock(&run->lock);
+        if(i < 0) { break; }
+        RunBatchSession(&run->sessions[i], run->ticks);
+    }
+    return NULL;
+}
+
+int CountCores(void) {
+#if defined(_WIN32)
+    return pthread_num_processors_np();
+#else
+    return (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
+//many independent matches in one process, one Game per session and no window
+int startBatch(int sessions, int threads, int seconds)
+{
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    if(sessions < 1 || seconds < 1) { return 1; }
+    if(threads < 1) { threads = CountCores(); }
+    if(threads > sessions) { threads = sessions; }
+    if(threads > BATCH_MAX_THREADS) { threads = BATCH_MAX_THREADS; }
+    BatchRun run = { .count = sessions, .ticks = (uint)seconds * BATCH_TICK_RATE };
+    run.sessions = calloc(sessions, sizeof(BatchSession));
+    if(!run.sessions) { return 1; }
+    for(int i = 0; i < sessions; i++) {
+        run.sessions[i].seed = i + 1;
+    }
+    pthread_mutex_init(&run.lock, NULL);
+    printf("Batch of %d sessions, %d s of play each, on %d threads\n", sessions, seconds, threads);
+
+    double start = NetTime();
+    pthread_t workers[BATCH_MAX_THREADS];
+    int started = 0;
+    for(int i = 1; i < threads; i++) {
+        if(pthread_create(&workers[started], NULL, &BatchWorkerMain, &run) == 0) { started++; }
+    }
+    //the main thread is one of the workers, and does it all if no other could be started
+    BatchWorkerMain(&run);
+    for(int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    double elapsed = NetTime() - start;
+    pthread_mutex_destroy(&run.lock);
+
+    uint64_t totalTicks = 0;
+    int wins = 0, losses = 0;
+    for(int i = 0; i < sessions; i++) {
+        const BatchSession* s = &run.sessions[i];
+        printf("session %d (seed %u): %s, wave %d, score %d, %u ticks, state %016llx, %.2f s\n", i, s->seed,
+            s->outcome == MO_Win ? "win" : s->outcome == MO_GameOver ? "game over" : "time up",
+            s->wave, s->score, s->ticks, (unsigned long long)s->state, s->seconds);
+        totalTicks += s->ticks;
+        wins += s->outcome == MO_Win;
+        losses += s->outcome == MO_GameOver;
+    }
+    printf("%d wins, %d game overs, %d timed out\n", wins, losses, sessions - wins - losses);
+    printf("%.2f s wall, %.0f ticks/s, %.1fx real time\n", elapsed, totalTicks / elapsed,
+        totalTicks / (double)BATCH_TICK_RATE / elapsed);
+    free(run.sessions);
+    return 0;
+}
+
+//the windowed bot path without the window, a restless mouse goes through RunSimulationTick every tick
+//and must not reach the bot, so the match has to end exactly as the batch runner's does
+int startBotCheck(uint seed, int seconds)
+{
+    if(seconds < 1) { return 1; }
+    BatchSession batch = { .seed = seed };
+    RunBatchSession(&batch, (uint)seconds * BATCH_TICK_RATE);
+    RenderSnapshot* r = malloc(sizeof(RenderSnapshot));
+    Game* g = NewGame(seed);
+    if(!r || !g) {
+        free(r);
+        FreeGame(g);
+        return 1;
+    }
+    g->localPlayer = 0;
+    InitPlayer(g, &g->Players[0], 0);
+    g->Players[0].bot = true;
+    PlayerInput idle = g->Players[0].input;
+    SpawnWorld(g);
+    uint tick = 0;
+    while(tick < batch.ticks && g->outcome == MO_None) {
+        idle.rotation.y = fmodf(idle.rotation.y + 7.0f, 360.0f);
+        idle.fireCount += !(tick % 3);
+        RunSimulationTick(g, idle, 1.0f / BATCH_TICK_RATE, 1, r);
+        tick++;
+    }
+    uint64_t state = HashGame(g);
+    bool same = tick == batch.ticks && g->outcome == batch.outcome && state == batch.state;
+    printf("batch:   %u ticks, wave %d, score %d, state %016llx\n", batch.ticks, batch.wave, batch.score, (unsigned long long)batch.state);
+    printf("handoff: %u ticks, wave %d, score %d, state %016llx\n", tick, g->curWave + 1, g->score, (unsigned long long)state);
+    printf("%s\n", same ? "the windowed handoff plays the bot exactly like the batch runner" : "the windowed handoff diverged from the batch runner");
+    FreeGame(g);
+    free(r);
+    return same ? 0 : 1;
+}
+#pragma endregion
@@ -1 +1,19 @@
-int startGame(bool);
\ No newline at end of file
+#include <stdbool.h>
+
+//frame rate arguments, anything above zero is a paced cap without vsync
+#define FRAME_RATE_VSYNC 0
+#define FRAME_RATE_UNCAPPED -1
+
+//bot hands the local player to the built-in bot, speed is simulation ticks per frame
+int startGame(bool drawDebug, int fps, bool bot, int speed);
+int startServer(unsigned short port);
+int startClient(bool drawDebug, const char* host, unsigned short port, int fps);
+int startBots(int count, const char* host, unsigned short port);
+//Prometheus text on http://127.0.0.1:<port>/metrics for the game, client and server modes
+bool EnableMetrics(unsigned short port);
+//threads below 1 means one per core
+int startBatch(int sessions, int threads, int seconds);
+//plays one seed through the windowed bot handoff and the batch runner, nonzero when they end differently
+int startBotCheck(unsigned int seed, int seconds);
+//prints how many bytes each kind of entity takes in this build
+int startMemoryReport(void);
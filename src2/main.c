@@ -1,17 +1,76 @@
 #include "game.h"
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 
+#define DEFAULT_PORT 27015
+
 int main(int argc, char* argv[])
 {
 	bool drawDebugRays = false;
+	int fps = FRAME_RATE_VSYNC;
+	bool bot = false;
+	int speed = 1;
+	const char* host = "127.0.0.1";
+	unsigned short port = DEFAULT_PORT;
 
 	for (int i = 1; i < argc; i++)
 	{
-		if (strcmp(argv[i], "debug")) {
+		if (!strcmp(argv[i], "debug")) {
 			drawDebugRays = true;
 		}
+		if (!strcmp(argv[i], "uncapped")) {
+			fps = FRAME_RATE_UNCAPPED;
+		}
+		if (!strcmp(argv[i], "fps") && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+			fps = atoi(argv[i + 1]);
+		}
+		if (!strcmp(argv[i], "bot")) {
+			bot = true;
+		}
+		if (!strcmp(argv[i], "speed") && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+			speed = atoi(argv[i + 1]);
+		}
+		if (!strcmp(argv[i], "metrics") && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+			EnableMetrics((unsigned short)atoi(argv[i + 1]));
+		}
+	}
+
+	// sus server [port]
+	// sus connect <host> [port]
+	// sus bots <count> [host] [port]
+	// sus batch <sessions> [threads] [seconds]
+	// sus botcheck <seed> [seconds]
+	// sus memory
+	// debug, uncapped and fps <n> may follow any of the client modes
+	// bot and speed <n> play the local game unattended, fast-forwarded n ticks per frame
+	// metrics <port> may follow any mode but bots and batch
+	if (argc > 1 && !strcmp(argv[1], "server")) {
+		if (argc > 2) port = (unsigned short)atoi(argv[2]);
+		return startServer(port);
+	}
+	if (argc > 2 && !strcmp(argv[1], "connect")) {
+		host = argv[2];
+		if (argc > 3 && atoi(argv[3]) > 0) port = (unsigned short)atoi(argv[3]);
+		return startClient(drawDebugRays, host, port, fps);
+	}
+	if (argc > 2 && !strcmp(argv[1], "bots")) {
+		if (argc > 3) host = argv[3];
+		if (argc > 4) port = (unsigned short)atoi(argv[4]);
+		return startBots(atoi(argv[2]), host, port);
+	}
+	if (argc > 2 && !strcmp(argv[1], "batch")) {
+		int threads = argc > 3 ? atoi(argv[3]) : 0;
+		int seconds = argc > 4 ? atoi(argv[4]) : 300;
+		return startBatch(atoi(argv[2]), threads, seconds);
+	}
+	if (argc > 2 && !strcmp(argv[1], "botcheck")) {
+		int seconds = argc > 3 ? atoi(argv[3]) : 300;
+		return startBotCheck((unsigned int)atoi(argv[2]), seconds);
+	}
+	if (argc > 1 && !strcmp(argv[1], "memory")) {
+		return startMemoryReport();
 	}
 	
-	startGame(drawDebugRays);
-}
\ No newline at end of file
+	return startGame(drawDebugRays, fps, bot, speed);
+}
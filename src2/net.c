@@ -0,0 +1,222 @@
+#include "net.h"
+#include <string.h>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+bool NetInit(void) {
+#if defined(_WIN32)
+    WSADATA wsa;
+    return WSAStartup(MAKEWORD(2, 2), &wsa) == 0;
+#else
+    return true;
+#endif
+}
+
+void NetShutdown(void) {
+#if defined(_WIN32)
+    WSACleanup();
+#endif
+}
+
+static void NetSetNonBlocking(NetSocket sock) {
+#if defined(_WIN32)
+    u_long nonBlocking = 1;
+    ioctlsocket(sock, FIONBIO, &nonBlocking);
+#else
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+#endif
+}
+
+NetSocket NetOpen(uint16_t port) {
+    NetSocket sock = (NetSocket)socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+#if defined(_WIN32)
+    if((SOCKET)sock == INVALID_SOCKET) { return -1; }
+#else
+    if(sock < 0) { return -1; }
+#endif
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if(bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        NetClose(sock);
+        return -1;
+    }
+    NetSetNonBlocking(sock);
+    return sock;
+}
+
+void NetClose(NetSocket sock) {
+    if(sock < 0) { return; }
+#if defined(_WIN32)
+    closesocket((SOCKET)sock);
+#else
+    close(sock);
+#endif
+}
+
+bool NetResolve(const char* host, uint16_t port, NetAddress* out) {
+    struct addrinfo hints = {0};
+    struct addrinfo* res = NULL;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if(getaddrinfo(host, NULL, &hints, &res) != 0 || !res) { return false; }
+    out->host = ntohl(((struct sockaddr_in*)res->ai_addr)->sin_addr.s_addr);
+    out->port = port;
+    freeaddrinfo(res);
+    return true;
+}
+
+bool NetAddressEqual(NetAddress a, NetAddress b) {
+    return a.host == b.host && a.port == b.port;
+}
+
+int NetSend(NetSocket sock, NetAddress to, const void* data, int len) {
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(to.host);
+    addr.sin_port = htons(to.port);
+    return (int)sendto(sock, data, len, 0, (struct sockaddr*)&addr, sizeof(addr));
+}
+
+int NetReceive(NetSocket sock, NetAddress* from, void* buffer, int size) {
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    int len = (int)recvfrom(sock, buffer, size, 0, (struct sockaddr*)&addr, &addrLen);
+    if(len < 0) { return -1; }
+    if(from) {
+        from->host = ntohl(addr.sin_addr.s_addr);
+        from->port = ntohs(addr.sin_port);
+    }
+    return len;
+}
+
+NetSocket NetListen(uint16_t port) {
+    NetSocket sock = (NetSocket)socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+#if defined(_WIN32)
+    if((SOCKET)sock == INVALID_SOCKET) { return -1; }
+#else
+    if(sock < 0) { return -1; }
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+#endif
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if(bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(sock, 4) < 0) {
+        NetClose(sock);
+        return -1;
+    }
+    NetSetNonBlocking(sock);
+    return sock;
+}
+
+NetSocket NetAccept(NetSocket listener) {
+    NetSocket sock = (NetSocket)accept(listener, NULL, NULL);
+#if defined(_WIN32)
+    if((SOCKET)sock == INVALID_SOCKET) { return -1; }
+#else
+    if(sock < 0) { return -1; }
+#endif
+    //only inherited from the listener on some platforms
+    NetSetNonBlocking(sock);
+    return sock;
+}
+
+int NetWrite(NetSocket sock, const void* data, int len) {
+#if defined(_WIN32)
+    return (int)send(sock, data, len, 0);
+#else
+    //a peer that hung up must not take the process down with SIGPIPE
+    return (int)send(sock, data, len, MSG_NOSIGNAL);
+#endif
+}
+
+int NetRead(NetSocket sock, void* buffer, int size) {
+    int len = (int)recv(sock, buffer, size, 0);
+    return len < 0 ? -1 : len;
+}
+
+double NetTime(void) {
+#if defined(_WIN32)
+    static LARGE_INTEGER freq = {0};
+    LARGE_INTEGER now;
+    if(!freq.QuadPart) { QueryPerformanceFrequency(&freq); }
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+void NetSleep(double seconds) {
+    if(seconds <= 0) { return; }
+#if defined(_WIN32)
+    Sleep((DWORD)(seconds * 1000.0));
+#else
+    struct timespec ts;
+    ts.tv_sec = (time_t)seconds;
+    ts.tv_nsec = (long)((seconds - (double)ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+#endif
+}
+
+#pragma region Buffer
+NetBuffer NetBufferWrap(void* data, int size) {
+    return (NetBuffer){ .data = data, .size = size, .cursor = 0, .overflow = false };
+}
+
+void NetWriteByte(NetBuffer* b, unsigned int v) {
+    if(b->cursor >= b->size) { b->overflow = true; return; }
+    b->data[b->cursor++] = (unsigned char)v;
+}
+
+//LEB128, small values take a single byte
+void NetWriteUVar(NetBuffer* b, uint32_t v) {
+    while(v >= 0x80) {
+        NetWriteByte(b, (v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    NetWriteByte(b, v);
+}
+
+//zigzag so small negative deltas stay small too
+void NetWriteSVar(NetBuffer* b, int32_t v) {
+    NetWriteUVar(b, ((uint32_t)v << 1) ^ (uint32_t)(v >> 31));
+}
+
+unsigned int NetReadByte(NetBuffer* b) {
+    if(b->cursor >= b->size) { b->overflow = true; return 0; }
+    return b->data[b->cursor++];
+}
+
+uint32_t NetReadUVar(NetBuffer* b) {
+    uint32_t v = 0;
+    for(int shift = 0; shift < 35; shift += 7) {
+        unsigned int byte = NetReadByte(b);
+        v |= (uint32_t)(byte & 0x7F) << shift;
+        if(!(byte & 0x80)) { break; }
+    }
+    return v;
+}
+
+int32_t NetReadSVar(NetBuffer* b) {
+    uint32_t v = NetReadUVar(b);
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+#pragma endregion
@@ -0,0 +1,49 @@
+#ifndef NET_H
+#define NET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef intptr_t NetSocket;
+
+typedef struct {
+    uint32_t host;
+    uint16_t port;
+} NetAddress;
+
+typedef struct {
+    unsigned char* data;
+    int size;
+    int cursor;
+    bool overflow;
+} NetBuffer;
+
+bool NetInit(void);
+void NetShutdown(void);
+//port 0 binds an ephemeral port, returns -1 on failure
+NetSocket NetOpen(uint16_t port);
+void NetClose(NetSocket sock);
+bool NetResolve(const char* host, uint16_t port, NetAddress* out);
+bool NetAddressEqual(NetAddress a, NetAddress b);
+int NetSend(NetSocket sock, NetAddress to, const void* data, int len);
+//non-blocking, returns -1 when nothing is pending
+int NetReceive(NetSocket sock, NetAddress* from, void* buffer, int size);
+//TCP on the loopback interface only, for local tooling rather than players
+NetSocket NetListen(uint16_t port);
+//non-blocking, returns -1 when nobody is waiting, the connection is non-blocking too
+NetSocket NetAccept(NetSocket listener);
+int NetWrite(NetSocket sock, const void* data, int len);
+//-1 when nothing is pending, 0 once the peer has closed
+int NetRead(NetSocket sock, void* buffer, int size);
+double NetTime(void);
+void NetSleep(double seconds);
+
+NetBuffer NetBufferWrap(void* data, int size);
+void NetWriteByte(NetBuffer* b, unsigned int v);
+void NetWriteUVar(NetBuffer* b, uint32_t v);
+void NetWriteSVar(NetBuffer* b, int32_t v);
+unsigned int NetReadByte(NetBuffer* b);
+uint32_t NetReadUVar(NetBuffer* b);
+int32_t NetReadSVar(NetBuffer* b);
+
+#endif